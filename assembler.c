@@ -12,10 +12,12 @@ static const char* general_fail_pref = "<ASM ERROR>";
 static const char* internal_fail_pref = "<ASM INTERNAL ERROR>";
 static const char* warn_pref = "<ASM WARNING>";
 static char run_sisa16 = 0;
+static sisa_vm* vm = NULL; /*Only exists if we are running the program.*/
 static char enable_dis_comments = 1;
 static char clear_output = 0;
 static void ASM_PUTS(const unsigned char* s){if(!clear_output)puts((const char*)s);}
 static char* infilename = NULL;
+static const char* profile_filename = NULL; /*-profile, with -run*/
 
 
 
@@ -184,8 +186,14 @@ static void DONT_WANT_TO_INLINE_THIS fputbyte(unsigned char b, FILE* f){
 			if(npasses == 1)
 				fputc(b, f);
 		} else {
-			if(npasses == 1)
-				M_SAVER[0][outputcounter]=b;
+			if(npasses == 1){
+				u* p = sisa_mem_wp(vm->M_SAVER[0], outputcounter);
+				if(!p){
+					puts("<ASM ERROR> Cannot allocate memory for the virtual machine.");
+					exit(1);
+				}
+				*p=b;
+			}
 		}
 	}
 	outputcounter++; outputcounter&=0xffffff;
@@ -219,12 +227,18 @@ int main(int argc, char** argv){
 	{
 		if(strprefix("-o",argv[i-1]))outfilename = argv[i];
 		if(strprefix("-i",argv[i-1]))infilename = argv[i];
+		if(!strcmp("-profile",argv[i-1]))profile_filename = argv[i];
 		if(strprefix("-run",argv[i-1])){
 			/*FILE* f; unsigned long which = 0;*/
 			infilename = argv[i];
 			run_sisa16 = 1;
 			clear_output = 1;
 			outfilename = NULL;
+			if(!vm) vm = sisa_vm_new(0);
+			if(!vm){
+				puts("<ASM ERROR> Cannot allocate the virtual machine.");
+				exit(1);
+			}
 		}
 		if(	strprefix("-nc",argv[i-2])
 			||strprefix("--no-comments",argv[i-2])) {
@@ -234,14 +248,14 @@ int main(int argc, char** argv){
 			unsigned long loc;
 			puts("//Beginning Disassembly");
 			loc = strtoul(argv[i],0,0) & 0xffFFff;
-			disassembler(argv[i-1], loc, 3, 256 * 256 * 256 + 1, M_SAVER[0]);
+			disassembler(argv[i-1], loc, 3, 256 * 256 * 256 + 1, NULL);
 			exit(0);
 		}
 		if(strprefix("--full-disassemble",argv[i-2]) || strprefix("-fdis",argv[i-2]) || strprefix("--full-disassembly",argv[i-2]) ){
 			unsigned long loc;
 			puts("//Beginning Disassembly");
 			loc = strtoul(argv[i],0,0) & 0xffFFff;
-			disassembler(argv[i-1], loc, 0x1000001, 256 * 256 * 256 + 1, M_SAVER[0]);
+			disassembler(argv[i-1], loc, 0x1000001, 256 * 256 * 256 + 1, NULL);
 			exit(0);
 		}
 	}}
@@ -462,6 +476,7 @@ int main(int argc, char** argv){
 			puts("Optional argument: -pl: Print lines");
 			puts("Optional argument: -C: display compiletime environment information (What C compiler you used) as well as Author.");
 			puts("Optional argument: -run: Build and Execute assembly file, like -i. Compatible with shebangs on *nix machines.\nTry adding `#!/usr/bin/sisa16_asm -run` to the start of your programs!");
+			puts("Optional argument: -profile: with -run, write an instruction profile to the given file and print a summary. Needs a build with -DUSE_PROFILE.");
 			puts("Optional argument: -v, -h, --help, --version: This printout.");
 			puts("\n\nSISA-16 Macro Assembler, Disassembler, Debugger, and Emulator in Pure Glorious ANSI/ISO C90, Version " SISA_VERSION);
 			puts("\"Let all that you do be done with love\"");
@@ -2059,50 +2074,64 @@ int main(int argc, char** argv){
 			exit(1);
 		}
 #endif
-		R=0;e();
-		if(R==1)puts("\n<Errfl, 16 bit div by 0>\n");
-		if(R==2)puts("\n<Errfl, 16 bit mod by 0>\n");
-		if(R==3)puts("\n<Errfl, 32 bit div by 0>\n");
-		if(R==4)puts("\n<Errfl, 32 bit mod by 0>\n");
-		if(R==5)puts("\n<Errfl, Bad Segment Page>\n");
-		if(R==6){
+		if(profile_filename){
+#ifdef USE_PROFILE
+			vm->prof = sisa_prof_new();
+			if(!vm->prof){
+				puts("<ASM ERROR> Cannot allocate the profiler.");
+				exit(1);
+			}
+#else
+			puts("<ASM WARNING> This build has no profiler, rebuild with -DUSE_PROFILE to use -profile.");
+#endif
+		}
+		vm->R=0;e(vm);
+#ifdef USE_PROFILE
+		if(vm->prof) sisa_prof_report(vm->prof, profile_filename);
+#endif
+		if(vm->R==1)puts("\n<Errfl, 16 bit div by 0>\n");
+		if(vm->R==2)puts("\n<Errfl, 16 bit mod by 0>\n");
+		if(vm->R==3)puts("\n<Errfl, 32 bit div by 0>\n");
+		if(vm->R==4)puts("\n<Errfl, 32 bit mod by 0>\n");
+		if(vm->R==5)puts("\n<Errfl, Bad Segment Page>\n");
+		if(vm->R==6){
 			/*puts("\n<Errfl, Segment Cannot be Zero Pages>\n");*/
 			puts("\r\n<Errfl, deprecated error>\r\n");
 		}
-		if(R==7)puts("\n<Errfl, Segment Failed Allocation>\n");
+		if(vm->R==7)puts("\n<Errfl, Segment Failed Allocation>\n");
 #if defined(NO_FP)
-		if(R==13)
+		if(vm->R==13)
 		{puts("\n<Errfl, Either signed division or the FPU were disabled during compilation.>\n");
-		R=0;}
-		if(R==8)puts("\n<Errfl, Floating point unit disabled by compiletime options>\n");
+		vm->R=0;}
+		if(vm->R==8)puts("\n<Errfl, Floating point unit disabled by compiletime options>\n");
 #else
-		if(R==8)puts("\n<Errfl, Internal error, reporting broken SISA16 FPU. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
+		if(vm->R==8)puts("\n<Errfl, Internal error, reporting broken SISA16 FPU. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
 #endif
 
-		if(R==9)puts("\n<Errfl, Floating point divide by zero>\n");
+		if(vm->R==9)puts("\n<Errfl, Floating point divide by zero>\n");
 #if defined(NO_SIGNED_DIV)
-		if(R==13)
+		if(vm->R==13)
 				{puts("\n<Errfl, Either signed division or the FPU were disabled during compilation.>\n");
-				R=0;}
-		if(R==10)puts("\n<Errfl, Signed 32 bit division disabled by compiletime options>\n");
+				vm->R=0;}
+		if(vm->R==10)puts("\n<Errfl, Signed 32 bit division disabled by compiletime options>\n");
 #else
-		if(R==10)puts("\n<Errfl, Internal error, reporting broken SISA16 signed integer division module. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
+		if(vm->R==10)puts("\n<Errfl, Internal error, reporting broken SISA16 signed integer division module. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
 #endif
-		if(R==11)puts("\n<Errfl, Sandboxing limit reached >\n");
-		if(R==12)puts("\n<Errfl, Sandboxing could not allocate needed memory.>\n");
-		if(R==13)
+		if(vm->R==11)puts("\n<Errfl, Sandboxing limit reached >\n");
+		if(vm->R==12)puts("\n<Errfl, Sandboxing could not allocate needed memory.>\n");
+		if(vm->R==13)
 		{
 			puts("\n<Errfl, Internal error, Broken Float-Int Interop. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
-			R=0;
+			vm->R=0;
 		}
-		if(R==14){
+		if(vm->R==14){
 #if defined(NO_SEGMENT)
 			puts("\n<Errfl, Segment Disabled>");
 #else
 			puts("\n<Errfl, Internal error, Reporting bad segment but not set that way at compiletime. Report this bug! https://github.com/gek169/Simple_ISA/   >");
 #endif
 		}
-		if(R==15 || R==16 || R==17 || R==18 || R==19){
+		if(vm->R==15 || vm->R==16 || vm->R==17 || vm->R==18 || vm->R==19){
 			puts("\n<Errfl, Privileged opcode executed underprivileged.>");
 		}		
 	}
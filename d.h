@@ -4,7 +4,21 @@
 
 static const size_t DISK_ACCESS_MASK = 0x3FffFFff;
 
-static unsigned short shouldquit = 0;
+/*
+	The disk image is mapped into the host's memory where there is mmap, so that reading or writing a page is a memcpy.
+	NO_DISK_MMAP makes it go through stdio like everywhere else.
+*/
+#if !defined(NO_DISK_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define USE_DISK_MMAP
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/*Ctrl+C goes to the whole process, so it stops every VM in it, on top of each one's own shouldquit.*/
+static volatile int sisa_ctrlc = 0;
 
 /*
 __#if defined(__arm__) && defined(USE_TERMIOS)
@@ -16,7 +30,7 @@ __#endif
 #define TRAP_CTRLC signal(SIGINT, emu_respond);
 void emu_respond(int bruh){
 	(void)bruh;
-	shouldquit = 0xffFF;
+	sisa_ctrlc = 1;
 	return;
 }
 #else
@@ -27,71 +41,268 @@ void emu_respond(int bruh){
 #ifdef USE_TERMIOS
 #undef USE_TERMIOS
 #endif
+#define SDL_MAIN_HANDLED
+#ifdef __TINYC__
+#define SDL_DISABLE_IMMINTRIN_H 1
+#endif
+#include <SDL2/SDL.h>
+/*
+	Counters the SDL2 driver shares between the VM, the audio callback and the window thread.
+	They are the compiler's atomics rather than SDL's, so that headless never calls into SDL.
+*/
+#if defined(__GNUC__) || defined(__clang__)
+typedef struct{int value;} sisa_atomic;
+#define sisa_atomic_get(a) __atomic_load_n(&(a)->value, __ATOMIC_SEQ_CST)
+#define sisa_atomic_set(a, v) __atomic_store_n(&(a)->value, (v), __ATOMIC_SEQ_CST)
+#define sisa_atomic_add(a, v) __atomic_fetch_add(&(a)->value, (v), __ATOMIC_SEQ_CST)
+#else
+typedef SDL_atomic_t sisa_atomic;
+#define sisa_atomic_get(a) SDL_AtomicGet(a)
+#define sisa_atomic_set(a, v) SDL_AtomicSet(a, v)
+#define sisa_atomic_add(a, v) SDL_AtomicAdd(a, v)
+#endif
 #endif
 #include "isa_pre.h"
+/*
+	With threads, the SDL2 window gets a thread of its own, which opens it, pumps its events and presents it.
+	The screen interrupt only draws the tiles which changed and hands them over, so the guest never waits
+	on the driver or on vsync. Not on macOS, where windows only work from the main thread.
+	NO_SDL_THREAD keeps it all on the VM's thread.
+*/
+#if defined(USE_SDL2) && defined(USE_THREADS) && !defined(NO_SDL_THREAD) && !defined(__APPLE__)
+#define SISA_SDL_THREAD
+#define SISA_GFX_LOCK(dv) pthread_mutex_lock(&(dv)->gfx_lock);
+#define SISA_GFX_UNLOCK(dv) pthread_mutex_unlock(&(dv)->gfx_lock);
+#else
+#define SISA_GFX_LOCK(dv) /*a comment*/
+#define SISA_GFX_UNLOCK(dv) /*a comment*/
+#endif
+#ifdef USE_THREADS
+/*ms milliseconds from now, for pthread_cond_timedwait.*/
+static void sisa_time_after(struct timespec* ts, UU ms){
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ms / 1000;
+	ts->tv_nsec += (long)(ms % 1000) * 1000000;
+	if(ts->tv_nsec >= 1000000000){ts->tv_sec++; ts->tv_nsec -= 1000000000;}
+}
+#endif
+#ifdef USE_SDL2
+/*Sleep for ms milliseconds, headless, where SDL isn't there to do it. Without a monotonic clock, SDL does after all.*/
+static void sisa_sleep_ms(UU ms){
+#if defined(CLOCK_MONOTONIC)
+	sisa_u64 end = sisa_now_ns() + (sisa_u64)ms * 1000000;
+	sisa_u64 now;
+	while((now = sisa_now_ns()) < end){
+		struct timespec ts;
+		ts.tv_sec = (end - now) / 1000000000;
+		ts.tv_nsec = (long)((end - now) % 1000000000);
+		nanosleep(&ts, NULL);
+	}
+#else
+	SDL_Delay(ms);
+#endif
+}
+#endif
 /*
 	buffers for stdout and stdin.
 */
 #define SCREEN_WIDTH_CHARS 80
 #define SCREEN_HEIGHT_CHARS 60
-static unsigned char stdout_buf[(SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS) + SCREEN_WIDTH_CHARS] = {0};
-#ifdef USE_SDL2
-static const UU SCREEN_LOC = 0xB00000;
-static const UU AUDIO_LOC_MEM = (0xffFF + SCREEN_LOC + (SCREEN_WIDTH_CHARS * 64 * SCREEN_HEIGHT_CHARS)) & 0xFF0000;
+/*Bytes of streamed audio the SDL2 driver buffers, about a second at 16 kHz 16 bit mono.*/
+#define SISA_AUDIO_RING 0x8000
+/*What interrupt 3 plays, SISA_AUDIO_SHOT bytes from 0xB50000 of the active audio user's memory.*/
+#define SISA_AUDIO_AT 0xB50000
+#define SISA_AUDIO_SHOT 0xB0000
+/*Characters typed ahead that it keeps.*/
+#define SISA_KEY_RING 0x1000
+
 /*
-	The SDL2 driver keeps a "standard in" buffer.
+	A disk image file.
 */
-static unsigned char stdin_buf[(SCREEN_WIDTH_CHARS * 64 * SCREEN_HEIGHT_CHARS)] = {0};
+struct sisa_img{
+	FILE* f; /*when it isn't mapped*/
+#ifdef USE_DISK_MMAP
+	int fd;
+	u* map; /*NULL until the image is opened*/
+	size_t len; /*how much is mapped*/
+	size_t size; /*how much of that the file covers*/
+#endif
+};
 /*
-	buffer pointer.
+	Driver state owned by a single VM.
 */
-unsigned short stdin_bufptr = 0;
+struct sisa_dev{
+	const char* disk_name; /*disk image used by the 0xFF10 to 0xFF1A interrupts.*/
+	const char* disk_base; /*read-only image under it, which makes disk_name an overlay. NULL for none.*/
+	struct sisa_img disk;
+	struct sisa_img base;
+	u* disk_bits; /*with a base, which pages the overlay has, a bit each*/
+	struct sisa_aio* aio_todo; /*queued transfers, oldest first*/
+	struct sisa_aio* aio_todo_last;
+	struct sisa_aio* aio_done; /*finished ones nobody has collected yet, oldest first*/
+	struct sisa_aio* aio_done_last;
+	UU aio_count; /*queued plus finished*/
+	U aio_tag; /*the last tag handed out*/
+	unsigned short shouldquit; /*0xFFFF once the user asked to quit, see sisa_quit*/
+#ifdef USE_THREADS
+	pthread_t aio_th;
+	int aio_started;
+	int aio_quit;
+	pthread_mutex_t aio_lock;
+	pthread_cond_t aio_go; /*something was queued, or it is time to quit*/
+	pthread_cond_t aio_fin; /*a transfer finished*/
+#endif
+#ifdef USE_SDL2
+	/*
+		The SDL2 driver keeps a ring of the keys typed, oldest first.
+		Whoever pumps the events is the only one to write key_head, and gch the only one to write key_tail,
+		so neither takes a lock. Keys which don't fit are dropped.
+	*/
+	unsigned char key_ring[SISA_KEY_RING];
+	sisa_atomic key_head; /*keys ever typed*/
+	sisa_atomic key_tail; /*keys ever read*/
+	/*
+		The text screen, and the cursor position in it.
+	*/
+	unsigned char stdout_buf[(SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS) + SCREEN_WIDTH_CHARS];
+	UU curpos;
+	UU audio_left;
+	/*
+		The 64k regions interrupt 3's samples are in. The callback runs on SDL's audio thread, so it reads these
+		rather than the memory tables, which the VM may change under it. With sparse memory they hold a reference,
+		so a region stays around even if the task lets go of it, until interrupt 3 or 4 comes again.
+	*/
+	u* audio_shot[SISA_AUDIO_SHOT >> 16];
+	/*
+		Streamed audio, which 0xE020 appends to and the callback plays after whatever interrupt 3 started.
+		There is one writer of each end, so the callback takes from it without a lock, the ends are atomic.
+		Interrupt 4 empties it again, under SDL's audio lock.
+	*/
+	u audio_ring[SISA_AUDIO_RING];
+	sisa_atomic ring_head; /*bytes ever appended, only the guest writes it*/
+	sisa_atomic ring_tail; /*bytes ever played, only the callback writes it*/
+	sisa_atomic ring_underruns; /*times the callback wanted more than there was, while streaming*/
+	sisa_atomic ring_on; /*something was appended since the ring was last emptied*/
+	UU ring_underruns_seen; /*what 0xE022 last reported*/
+	sisa_u64 ring_clock; /*headless, up to when the ring has been played*/
+	char blocking_input;
+	U active_audio_user;
+	unsigned char FG_color;
+	unsigned char BG_color;
+	UU SDL_targ[SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS * 64];
+	UU vga_palette[256];
+	/*
+		What the screen showed last time, so that only the 8x8 tiles which changed are drawn again.
+	*/
+	u shown_fb[SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS * 64];
+	unsigned char shown_text[SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS]; /*the character drawn on each, 0 for none*/
+	char screen_stale; /*the palette, the colour or whose memory it is changed, so they all did*/
+	/*
+		The tiles of each row of SDL_targ drawn since the texture was last updated, none where first > last.
+	*/
+	u span_first[SCREEN_HEIGHT_CHARS];
+	u span_last[SCREEN_HEIGHT_CHARS];
+	/*
+		Headless, there is no window, nor any SDL at all: waits are nanosleep and the counters the compiler's atomics.
+		Frames are only drawn into SDL_targ, and written to frames_name if there is one,
+		and the rate they came at is reported at the end.
+	*/
+	char headless;
+	char frames_fmt; /*'p' for a stream of PPM images, 'y' for YUV4MPEG2, 'r' for raw RGB24*/
+	const char* frames_name;
+	FILE* frames;
+	UU nframes;
+	sisa_u64 frames_t0;
+#ifdef SISA_SDL_THREAD
+	UU up_px[SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS * 64]; /*the window thread's copy of those tiles*/
+	pthread_t gfx_th;
+	int gfx_started;
+	int gfx_quit;
+	char gfx_up; /*the window is open*/
+	char gfx_frame; /*there are spans to present*/
+	pthread_mutex_t gfx_lock; /*SDL_targ and the spans, and waiting on gfx_input*/
+	pthread_cond_t gfx_go; /*a frame is ready, or it is time to quit*/
+	pthread_cond_t gfx_input; /*a key came in, or the window opened*/
+#endif
+#endif
+};
+/*0xFFFF if this VM should stop, because it was asked to or because of Ctrl+C.*/
+static unsigned short sisa_quit(const struct sisa_dev* dv){
+	return sisa_ctrlc ? 0xffFF : dv->shouldquit;
+}
 
-/*
-	Cursor position.
-*/
-UU  curpos = 0;
+#if defined(USE_SDL2) || !defined(USE_TERMIOS)
+/*Where there is no telling what has come in, this takes a line, or n characters of one.*/
+static UU sisa_stdio_getn(u* buf, UU n){
+	UU i = 0;
+	int ch;
+	while(i < n && (ch = getchar()) != EOF){
+		buf[i++] = ch;
+		if(ch == '\n') break;
+	}
+	return i;
+}
+#endif
+
+#ifdef USE_SDL2
+static const UU SCREEN_LOC = 0xB00000;
+static const UU AUDIO_LOC_MEM = (0xffFF + SCREEN_LOC + (SCREEN_WIDTH_CHARS * 64 * SCREEN_HEIGHT_CHARS)) & 0xFF0000;
 
 /*
 	SDL2 driver, plus simple text mode.
 */
 
-#define SDL_MAIN_HANDLED
-#ifdef __TINYC__
-#define SDL_DISABLE_IMMINTRIN_H 1
-#endif
 
 #include "font8x8_basic.h"
-#include <SDL2/SDL.h>
+#include <ctype.h>
 /*
 	TODO- refactor/rewrite av driver, integrate with getchar/putchar to make a "text mode".
+	The window, renderer and audio device are the only driver state which isn't in struct sisa_dev:
+	SDL_Init and SDL_OpenAudio only give a process one of each, so they are static.
 */
 static SDL_Window *sdl_win = NULL;
 static SDL_Renderer *sdl_rend = NULL;
 static SDL_Texture *sdl_tex = NULL;
 static SDL_AudioSpec sdl_spec = {0};
 static const unsigned int display_scale = 2;
-static UU audio_left = 0;
-#ifndef SDL2_NO_EMULATE_BLOCKING_INPUT
-static char blocking_input = 1;
-#endif
-
-static unsigned char active_audio_user = 0;
-static unsigned char FG_color = 15;
-static unsigned char BG_color = 0;
-static UU SDL_targ[SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS * 64] = {0}; /*Default to all black.*/
-static UU vga_palette[256] = {
+static const UU vga_palette_default[256] = {
 #include "vga_pal.h"
 };
 static void DONT_WANT_TO_INLINE_THIS sdl_audio_callback(void *udata, Uint8 *stream, int len){
+	sisa_vm* vm = (sisa_vm*)udata;
+	struct sisa_dev* dv = vm->dev;
+	UU want, tail, n;
 	SDL_memset(stream, 0, len);
-	if(audio_left == 0){return;}
-	len = (len < audio_left) ? len : audio_left;
-	SDL_MixAudio(stream, M_SAVER[active_audio_user] + 0xB50000 + (0xB0000 - audio_left), len, SDL_MIX_MAXVOLUME);
-	audio_left -= len;
+	want = len;
+	len = ((UU)len < dv->audio_left) ? len : (int)dv->audio_left;
+	want -= len; /*the ring gets what is left after interrupt 3's samples*/
+	while(len > 0){
+		UU at = SISA_AUDIO_SHOT - dv->audio_left;
+		int chunk = len;
+		if((int)(0x10000 - (at & 0xffFF)) < chunk) chunk = 0x10000 - (at & 0xffFF);
+		SDL_MixAudio(stream, dv->audio_shot[at >> 16] + (at & 0xffFF), chunk, SDL_MIX_MAXVOLUME);
+		stream += chunk;
+		len -= chunk;
+		dv->audio_left -= chunk;
+	}
+	tail = sisa_atomic_get(&dv->ring_tail);
+	n = (UU)sisa_atomic_get(&dv->ring_head) - tail;
+	if(n < want && sisa_atomic_get(&dv->ring_on)) sisa_atomic_add(&dv->ring_underruns, 1);
+	if(n > want) n = want;
+	while(n){
+		UU at = tail % SISA_AUDIO_RING;
+		UU chunk = SISA_AUDIO_RING - at;
+		if(chunk > n) chunk = n;
+		SDL_MixAudio(stream, dv->audio_ring + at, chunk, SDL_MIX_MAXVOLUME);
+		stream += chunk;
+		tail += chunk;
+		n -= chunk;
+	}
+	sisa_atomic_set(&dv->ring_tail, tail);
 }
 
-static void DONT_WANT_TO_INLINE_THIS di(){
+/*Opens the window and the audio device. With SISA_SDL_THREAD, this is on the window thread.*/
+static void DONT_WANT_TO_INLINE_THIS sisa_sdl_open(sisa_vm* vm){
 	    if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0)
 	    {
 	        printf("SDL2 could not be initialized!\n"
@@ -104,7 +315,7 @@ static void DONT_WANT_TO_INLINE_THIS di(){
 		sdl_spec.silence = 0;
 		sdl_spec.samples = 2048;
 		sdl_spec.callback = sdl_audio_callback;
-		sdl_spec.userdata = NULL;
+		sdl_spec.userdata = vm;
 		sdl_win = SDL_CreateWindow("[SISA-16]",
 			SDL_WINDOWPOS_UNDEFINED,
 			SDL_WINDOWPOS_UNDEFINED,
@@ -140,53 +351,336 @@ static void DONT_WANT_TO_INLINE_THIS di(){
 		}
 		SDL_PauseAudio(0);
 		SDL_StartTextInput();
-#ifndef SISA_DEBUGGER
-		TRAP_CTRLC
-#endif
 }
-static void DONT_WANT_TO_INLINE_THIS dcl(){
+static void DONT_WANT_TO_INLINE_THIS sisa_sdl_close(){
 		SDL_DestroyTexture(sdl_tex);
 		SDL_DestroyRenderer(sdl_rend);
 		SDL_CloseAudio();
     	SDL_DestroyWindow(sdl_win);
 	    SDL_Quit();
 }
-static void pollevents(){
+static UU sisa_key_count(struct sisa_dev* dv){
+	return (UU)sisa_atomic_get(&dv->key_head) - (UU)sisa_atomic_get(&dv->key_tail);
+}
+/*Onto the keyboard ring, unless it is full. Returns whether it was.*/
+static int sisa_key_push(struct sisa_dev* dv, unsigned char c){
+	UU head = sisa_atomic_get(&dv->key_head);
+	if(head - (UU)sisa_atomic_get(&dv->key_tail) >= SISA_KEY_RING) return 0;
+	dv->key_ring[head % SISA_KEY_RING] = c;
+	sisa_atomic_set(&dv->key_head, head + 1); /*after the key*/
+	return 1;
+}
+/*Up to n keys off the keyboard ring, oldest first.*/
+static UU sisa_key_take(struct sisa_dev* dv, unsigned char* buf, UU n){
+	UU tail = sisa_atomic_get(&dv->key_tail);
+	UU have = (UU)sisa_atomic_get(&dv->key_head) - tail;
+	UU i;
+	if(n > have) n = have;
+	for(i = 0; i < n; i++) buf[i] = dv->key_ring[(tail + i) % SISA_KEY_RING];
+	sisa_atomic_set(&dv->key_tail, tail + n); /*after they were read*/
+	return n;
+}
+/*One event, onto the keyboard ring. Returns whether it put a key there, or quit.*/
+static int sisa_sdl_event(struct sisa_dev* dv, const SDL_Event* ev){
+	int got = 0;
+	if(ev->type == SDL_QUIT){dv->shouldquit = 0xFFff; got = 1;} /*Magic value for quit.*/
+	else if(ev->type == SDL_TEXTINPUT){
+		const char* b = ev->text.text;
+		while(*b) {got |= sisa_key_push(dv, *b); b++;}
+	}else if(ev->type == SDL_KEYDOWN){
+		switch(ev->key.keysym.scancode){
+			default: break;
+			case SDL_SCANCODE_DELETE: got = sisa_key_push(dv, 0x7F); break;
+			case SDL_SCANCODE_BACKSPACE: got = sisa_key_push(dv, 0x7F);break;
+			case SDL_SCANCODE_KP_BACKSPACE: got = sisa_key_push(dv, 0x7F);break;
+			case SDL_SCANCODE_RETURN: got = sisa_key_push(dv, 0xa);break;
+			case SDL_SCANCODE_RETURN2: got = sisa_key_push(dv, 0xa);break;
+			case SDL_SCANCODE_KP_ENTER: got = sisa_key_push(dv, 0xa);break;
+			case SDL_SCANCODE_ESCAPE: got = sisa_key_push(dv, '\e');break;
+		}
+	}
+	return got;
+}
+static void sisa_sdl_events(struct sisa_dev* dv){
 	SDL_Event ev;
-	while(SDL_PollEvent(&ev)){
-		if(ev.type == SDL_QUIT) shouldquit = 0xFFff; /*Magic value for quit.*/
-		else if(ev.type == SDL_TEXTINPUT){
-			char* b = ev.text.text;
-			while(*b) {stdin_buf[stdin_bufptr++] = *b; b++;}
-		}else if(ev.type == SDL_KEYDOWN){
-			switch(ev.key.keysym.scancode){
-				default: break;
-				case SDL_SCANCODE_DELETE: stdin_buf[stdin_bufptr++] = 0x7F; break;
-				case SDL_SCANCODE_BACKSPACE: stdin_buf[stdin_bufptr++] = 0x7F;break;
-				case SDL_SCANCODE_KP_BACKSPACE: stdin_buf[stdin_bufptr++] = 0x7F;break;
-				case SDL_SCANCODE_RETURN: stdin_buf[stdin_bufptr++] = 0xa;break;
-				case SDL_SCANCODE_RETURN2: stdin_buf[stdin_bufptr++] = 0xa;break;
-				case SDL_SCANCODE_KP_ENTER: stdin_buf[stdin_bufptr++] = 0xa;break;
-				case SDL_SCANCODE_ESCAPE: stdin_buf[stdin_bufptr++] = '\e';break;
+	int got = 0;
+	while(SDL_PollEvent(&ev)) got |= sisa_sdl_event(dv, &ev);
+#ifdef SISA_SDL_THREAD
+	if(got){
+		pthread_mutex_lock(&dv->gfx_lock);
+		pthread_cond_broadcast(&dv->gfx_input);
+		pthread_mutex_unlock(&dv->gfx_lock);
+	}
+#else
+	(void)got;
+#endif
+}
+/*Sends the spans of px to the texture, forgets them, and presents it.*/
+static void sisa_sdl_upload(const UU* px, u* first, u* last){
+	SDL_Rect screenrect;
+	SDL_Rect screenrect2;
+	UU y;
+	for(y = 0; y < SCREEN_HEIGHT_CHARS; y++){
+		SDL_Rect r;
+		if(first[y] > last[y]) continue;
+		r.x = first[y] * 8;
+		r.y = y * 8;
+		r.w = (last[y] + 1 - first[y]) * 8;
+		r.h = 8;
+		SDL_UpdateTexture(
+			sdl_tex,
+			&r,
+			px + r.y * SCREEN_WIDTH_CHARS * 8 + r.x,
+			(SCREEN_WIDTH_CHARS*8) * 4
+		);
+		first[y] = SCREEN_WIDTH_CHARS;
+		last[y] = 0;
+	}
+	screenrect.x = 0;
+	screenrect.y = 0;
+	screenrect.w = 8 * SCREEN_WIDTH_CHARS;
+	screenrect.h = 8 * SCREEN_HEIGHT_CHARS;
+	screenrect2 = screenrect;
+	screenrect2.w *= display_scale;
+	screenrect2.h *= display_scale;
+	SDL_RenderCopy(
+		sdl_rend, 
+		sdl_tex,
+		&screenrect,
+		&screenrect2
+	);
+	SDL_RenderPresent(sdl_rend);
+}
+/*
+	Headless video. The format of frames_name is picked by its extension, .ppm or .y4m, anything else is raw.
+*/
+static void sisa_headless_open(struct sisa_dev* dv){
+	const char* ext = dv->frames_name ? strrchr(dv->frames_name, '.') : NULL;
+	dv->frames_fmt = 'r';
+	if(ext && !strcmp(ext, ".ppm")) dv->frames_fmt = 'p';
+	if(ext && !strcmp(ext, ".y4m")) dv->frames_fmt = 'y';
+	if(dv->frames_name && !dv->frames){
+		dv->frames = fopen(dv->frames_name, "wb");
+		if(!dv->frames){
+			printf("SISA16 cannot open %s to write frames to.\n", dv->frames_name);
+			exit(1);
+		}
+		if(dv->frames_fmt == 'y')
+			fprintf(dv->frames, "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C444\n", SCREEN_WIDTH_CHARS * 8, SCREEN_HEIGHT_CHARS * 8);
+	}
+	dv->nframes = 0;
+	dv->frames_t0 = sisa_now_ns();
+}
+static void sisa_headless_close(struct sisa_dev* dv){
+	double secs = (double)(sisa_now_ns() - dv->frames_t0) / 1e9;
+	fprintf(stderr, "SISA16: %lu frames in %.3f seconds, %.1f per second\n",
+		(unsigned long)dv->nframes, secs, secs > 0 ? dv->nframes / secs : 0.0);
+	if(dv->frames) fclose(dv->frames);
+	dv->frames = NULL;
+}
+/*
+	The screen interrupt drew a frame into SDL_targ. Y4M is 4:4:4, one plane after the other, BT.601 studio range.
+*/
+static void sisa_headless_frame(struct sisa_dev* dv){
+	unsigned char line[SCREEN_WIDTH_CHARS * 8 * 3];
+	UU x, y, plane;
+	dv->nframes++;
+	memset(dv->span_first, SCREEN_WIDTH_CHARS, sizeof(dv->span_first));
+	memset(dv->span_last, 0, sizeof(dv->span_last));
+	if(!dv->frames) return;
+	if(dv->frames_fmt == 'p')
+		fprintf(dv->frames, "P6\n%u %u\n255\n", SCREEN_WIDTH_CHARS * 8, SCREEN_HEIGHT_CHARS * 8);
+	if(dv->frames_fmt == 'y'){
+		fputs("FRAME\n", dv->frames);
+		for(plane = 0; plane < 3; plane++)
+			for(y = 0; y < SCREEN_HEIGHT_CHARS * 8; y++){
+				const UU* px = dv->SDL_targ + y * SCREEN_WIDTH_CHARS * 8;
+				for(x = 0; x < SCREEN_WIDTH_CHARS * 8; x++){
+					long r = (px[x] >> 16) & 0xff, g = (px[x] >> 8) & 0xff, b = px[x] & 0xff;
+					if(plane == 0) line[x] = (66*r + 129*g + 25*b + 128 + (16<<8)) >> 8;
+					else if(plane == 1) line[x] = (-38*r - 74*g + 112*b + 128 + (128<<8)) >> 8;
+					else line[x] = (112*r - 94*g - 18*b + 128 + (128<<8)) >> 8;
+				}
+				fwrite(line, 1, SCREEN_WIDTH_CHARS * 8, dv->frames);
 			}
+		return;
+	}
+	for(y = 0; y < SCREEN_HEIGHT_CHARS * 8; y++){
+		const UU* px = dv->SDL_targ + y * SCREEN_WIDTH_CHARS * 8;
+		for(x = 0; x < SCREEN_WIDTH_CHARS * 8; x++){
+			line[x*3] = px[x] >> 16;
+			line[x*3+1] = px[x] >> 8;
+			line[x*3+2] = px[x];
 		}
+		fwrite(line, 1, sizeof(line), dv->frames);
 	}
 }
-static unsigned short gch(){
+#ifdef SISA_SDL_THREAD
+/*
+	The window thread. It takes the tiles the screen interrupt drew, copying them out of SDL_targ under the lock,
+	and presents them without it, so the next frame can be drawn in the meantime. Between frames it pumps events.
+*/
+static void* sisa_sdl_thread(void* arg){
+	sisa_vm* vm = arg;
+	struct sisa_dev* dv = vm->dev;
+	u first[SCREEN_HEIGHT_CHARS];
+	u last[SCREEN_HEIGHT_CHARS];
+	sisa_sdl_open(vm);
+	pthread_mutex_lock(&dv->gfx_lock);
+	dv->gfx_up = 1;
+	pthread_cond_broadcast(&dv->gfx_input);
+	for(;;){
+		struct timespec ts;
+		int frame, quit;
+		UU y;
+		sisa_time_after(&ts, 10);
+		while(!dv->gfx_frame && !dv->gfx_quit)
+			if(pthread_cond_timedwait(&dv->gfx_go, &dv->gfx_lock, &ts)) break;
+		quit = dv->gfx_quit; /*the last frame is still shown*/
+		frame = dv->gfx_frame;
+		if(frame){
+			for(y = 0; y < SCREEN_HEIGHT_CHARS; y++){
+				UU off = y * 64 * SCREEN_WIDTH_CHARS + dv->span_first[y] * 8;
+				UU r;
+				first[y] = dv->span_first[y];
+				last[y] = dv->span_last[y];
+				dv->span_first[y] = SCREEN_WIDTH_CHARS;
+				dv->span_last[y] = 0;
+				if(first[y] > last[y]) continue;
+				for(r = 0; r < 8; r++, off += SCREEN_WIDTH_CHARS * 8)
+					memcpy(dv->up_px + off, dv->SDL_targ + off, (last[y] + 1 - first[y]) * 8 * sizeof(UU));
+			}
+			dv->gfx_frame = 0;
+		}
+		pthread_mutex_unlock(&dv->gfx_lock);
+		sisa_sdl_events(dv);
+		if(frame) sisa_sdl_upload(dv->up_px, first, last);
+		pthread_mutex_lock(&dv->gfx_lock);
+		if(quit) break;
+	}
+	pthread_mutex_unlock(&dv->gfx_lock);
+	sisa_sdl_close();
+	return NULL;
+}
+static void sisa_sdl_stop(struct sisa_dev* dv){
+	if(!dv->gfx_started) return;
+	pthread_mutex_lock(&dv->gfx_lock);
+	dv->gfx_quit = 1;
+	pthread_cond_signal(&dv->gfx_go);
+	pthread_mutex_unlock(&dv->gfx_lock);
+	pthread_join(dv->gfx_th, NULL);
+	dv->gfx_started = 0;
+}
+#endif
+static void DONT_WANT_TO_INLINE_THIS di(sisa_vm* vm){
+		struct sisa_dev* dv = vm->dev;
+		if(dv->headless){
+			sisa_headless_open(dv);
+		}else{
+#ifdef SISA_SDL_THREAD
+			pthread_mutex_lock(&dv->gfx_lock);
+			dv->gfx_quit = 0;
+			dv->gfx_up = 0;
+			if(pthread_create(&dv->gfx_th, NULL, sisa_sdl_thread, vm)){
+				printf("SDL2 window thread creation failed.\n");
+				exit(1);
+			}
+			dv->gfx_started = 1;
+			while(!dv->gfx_up) pthread_cond_wait(&dv->gfx_input, &dv->gfx_lock);
+			pthread_mutex_unlock(&dv->gfx_lock);
+#else
+			sisa_sdl_open(vm);
+#endif
+		}
+#ifndef SISA_DEBUGGER
+		TRAP_CTRLC
+#endif
+}
+static void DONT_WANT_TO_INLINE_THIS dcl(sisa_vm* vm){
+		if(vm->dev->headless){
+			sisa_headless_close(vm->dev);
+			return;
+		}
+#ifdef SISA_SDL_THREAD
+		sisa_sdl_stop(vm->dev);
+#else
+		sisa_sdl_close();
+#endif
+}
+/*The window thread pumps the events itself.*/
+static void pollevents(sisa_vm* vm){
+#ifdef SISA_SDL_THREAD
+	(void)vm;
+#else
+	if(!vm->dev->headless) sisa_sdl_events(vm->dev);
+#endif
+}
+/*Headless, the keyboard is the host's standard input.*/
+static unsigned short gch(sisa_vm* vm){
+	struct sisa_dev* dv = vm->dev;
+	unsigned char ch;
+	if(dv->headless) return (unsigned short)getchar();
 #ifndef SDL2_NO_EMULATE_BLOCKING_INPUT
-	while(blocking_input && stdin_bufptr == 0){
+	while(dv->blocking_input && !sisa_key_count(dv)){
+#ifdef SISA_SDL_THREAD
+		pthread_mutex_lock(&dv->gfx_lock);
+		if(!sisa_key_count(dv)) pthread_cond_wait(&dv->gfx_input, &dv->gfx_lock);
+		pthread_mutex_unlock(&dv->gfx_lock);
+#else
 		SDL_Delay(16);
-		pollevents();
+		pollevents(vm);
+#endif
 	}
 #endif
-	if(stdin_bufptr){
-		stdin_bufptr--;
-		return stdin_buf[stdin_bufptr];
-	} else return 255;
+	return sisa_key_take(dv, &ch, 1) ? ch : 255;
+}
+/*Did gch find nothing, rather than a key? Only without blocking_input, and never headless, where 0xFFFF is the end.*/
+static int sisa_con_none(sisa_vm* vm, U ch){
+	return ch == 255 && !vm->dev->headless;
+}
+/*Up to n keys which have already been typed.*/
+static UU sisa_con_getn(sisa_vm* vm, u* buf, UU n){
+	if(vm->dev->headless) return sisa_stdio_getn(buf, n);
+	pollevents(vm);
+	return sisa_key_take(vm->dev, buf, n);
+}
+/*Is there a character for gch?*/
+static int sisa_con_pending(sisa_vm* vm){
+	struct sisa_dev* dv = vm->dev;
+	if(dv->headless) return 1; /*getchar will wait for it*/
+	pollevents(vm);
+	return sisa_key_count(dv) != 0 || sisa_quit(dv);
 }
+#ifdef SISA_SDL_THREAD
+/*Sleep for ms milliseconds, or until a character comes in if input is set.*/
+static void sisa_con_idle(sisa_vm* vm, UU ms, int input){
+	struct sisa_dev* dv = vm->dev;
+	struct timespec ts;
+	if(dv->headless){sisa_sleep_ms(ms); return;}
+	sisa_time_after(&ts, ms);
+	pthread_mutex_lock(&dv->gfx_lock);
+	while(!sisa_quit(dv) && !(input && sisa_key_count(dv)))
+		if(pthread_cond_timedwait(&dv->gfx_input, &dv->gfx_lock, &ts)) break;
+	pthread_mutex_unlock(&dv->gfx_lock);
+}
+#else
+/*Sleep for ms milliseconds, or until a character comes in if input is set. Any event wakes SDL up, so it goes round.*/
+static void sisa_con_idle(sisa_vm* vm, UU ms, int input){
+	Uint32 end;
+	if(vm->dev->headless){sisa_sleep_ms(ms); return;}
+	end = SDL_GetTicks() + ms;
+	for(;;){
+		Sint32 left = (Sint32)(end - SDL_GetTicks());
+		if(left <= 0 || sisa_quit(vm->dev)) return;
+		SDL_WaitEventTimeout(NULL, left);
+		if(input && sisa_con_pending(vm)) return;
+		if(!input) pollevents(vm);
+	}
+}
+#endif
 
-static void renderchar(unsigned char* bitmap, UU p) {
-	UU x, y, i, j, _x, _y;
+static void renderchar(struct sisa_dev* dv, unsigned char* bitmap, UU p) {
+	UU x, y, _x, _y;
 	UU set;
 	/*640/8 = 80, 480/8 = 60*/
 	_x = p%SCREEN_WIDTH_CHARS;
@@ -196,28 +690,40 @@ static void renderchar(unsigned char* bitmap, UU p) {
 	for (x = 0; x < 8; x++) {
 		for (y = 0; y < 8; y++) {
 			set = bitmap[x] & (1 << y);
-			if (set) SDL_targ[(_x+y) + (_y+x) * (SCREEN_WIDTH_CHARS * 8)] = vga_palette[FG_color];
+			if (set) dv->SDL_targ[(_x+y) + (_y+x) * (SCREEN_WIDTH_CHARS * 8)] = dv->vga_palette[dv->FG_color];
 		}
 	}
 }
-static void pch(unsigned short a){
+/*Tile p of shown_fb, through the palette.*/
+static void rendertile(struct sisa_dev* dv, UU p){
+	const UU* pal = dv->vga_palette;
+	const u* s = dv->shown_fb + (p / SCREEN_WIDTH_CHARS) * 64 * SCREEN_WIDTH_CHARS + (p % SCREEN_WIDTH_CHARS) * 8;
+	UU* d = dv->SDL_targ + (s - dv->shown_fb);
+	UU y;
+	for(y = 0; y < 8; y++, s += SCREEN_WIDTH_CHARS * 8, d += SCREEN_WIDTH_CHARS * 8){
+		d[0] = pal[s[0]]; d[1] = pal[s[1]]; d[2] = pal[s[2]]; d[3] = pal[s[3]];
+		d[4] = pal[s[4]]; d[5] = pal[s[5]]; d[6] = pal[s[6]]; d[7] = pal[s[7]];
+	}
+}
+static void pch(sisa_vm* vm, unsigned short a){
+	struct sisa_dev* dv = vm->dev;
 	if(a == '\n'){
-		curpos += SCREEN_WIDTH_CHARS;
+		dv->curpos += SCREEN_WIDTH_CHARS;
 	} else if(a == '\r'){
-		while(curpos%SCREEN_WIDTH_CHARS)curpos--;
+		while(dv->curpos%SCREEN_WIDTH_CHARS)dv->curpos--;
 	} else if(a == 8 || a == 0x7f){
-		stdout_buf[curpos-- % (SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)] = ' ';
+		dv->stdout_buf[dv->curpos-- % (SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)] = ' ';
 	} else if(a == '\t'){
 		do{
-			stdout_buf[curpos++ % (SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)] = ' ';
-		}while(curpos % 4);
+			dv->stdout_buf[dv->curpos++ % (SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)] = ' ';
+		}while(dv->curpos % 4);
 	} else {
-		stdout_buf[curpos++ % (SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)] = a;
+		dv->stdout_buf[dv->curpos++ % (SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)] = a;
 	}
-	if(curpos>=(SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)){
-		curpos -= SCREEN_WIDTH_CHARS;
-		memcpy(stdout_buf, stdout_buf + SCREEN_WIDTH_CHARS, SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS);
-		memset(stdout_buf+(SCREEN_WIDTH_CHARS- 1)*SCREEN_HEIGHT_CHARS, ' ', SCREEN_WIDTH_CHARS);
+	if(dv->curpos>=(SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS)){
+		dv->curpos -= SCREEN_WIDTH_CHARS;
+		memcpy(dv->stdout_buf, dv->stdout_buf + SCREEN_WIDTH_CHARS, SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS);
+		memset(dv->stdout_buf+(SCREEN_WIDTH_CHARS- 1)*SCREEN_HEIGHT_CHARS, ' ', SCREEN_WIDTH_CHARS);
 	}
 	/*putchar_unlocked(a);*/ /*for those poor terminal users at home.*/
 }
@@ -232,8 +738,14 @@ static void pch(unsigned short a){
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+/*
+	The terminal and stdout belong to the process, not to any one VM, so they are set up once,
+	by whichever VM gets to di() first, and put back at exit.
+*/
 static struct termios oldChars;
 static struct termios newChars;
+static unsigned char stdout_buf[(SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS) + SCREEN_WIDTH_CHARS];
 static void initTermios(int echo) 
 {
   tcgetattr(STDIN_FILENO, &oldChars); /* grab old terminal i/o settings */
@@ -245,23 +757,37 @@ static void initTermios(int echo)
 static void dieTermios(){
 	tcsetattr(STDIN_FILENO, TCSAFLUSH, &oldChars); /* use these new terminal i/o settings now */	
 }
-static void DONT_WANT_TO_INLINE_THIS di(){
+static void sisa_term_init(void){
 	initTermios(0);
 	atexit(dieTermios);
 #ifndef SISA_DEBUGGER
 		TRAP_CTRLC
 #endif
-	setvbuf ( stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+	setvbuf ( stdout, (char*)stdout_buf, _IOFBF, sizeof(stdout_buf));
 }
-static void dcl(){}
+#ifdef USE_THREADS
+static pthread_once_t sisa_term_once = PTHREAD_ONCE_INIT;
 #else
-static void di(){
+static int sisa_term_up = 0;
+#endif
+static void DONT_WANT_TO_INLINE_THIS di(sisa_vm* vm){
+	(void)vm;
+#ifdef USE_THREADS
+	pthread_once(&sisa_term_once, sisa_term_init);
+#else
+	if(!sisa_term_up){sisa_term_up = 1; sisa_term_init();}
+#endif
+}
+static void dcl(sisa_vm* vm){(void)vm;}
+#else
+static void di(sisa_vm* vm){
+	(void)vm;
 #ifndef SISA_DEBUGGER
 		TRAP_CTRLC
 #endif
 	return;
 }
-static void dcl(){return;}
+static void dcl(sisa_vm* vm){(void)vm;return;}
 #endif
 
 #endif
@@ -272,92 +798,670 @@ static void dcl(){return;}
 	non-sdl2 variants of 
 */
 #ifndef USE_SDL2
-static unsigned short gch(){
+static unsigned short gch(sisa_vm* vm){
+	(void)vm;
 #if defined(USE_TERMIOS)
 	return (unsigned short)getchar_unlocked();
 #else
 	return (unsigned short)getchar();
 #endif
 }
-static void pch(unsigned short a){
+static void pch(sisa_vm* vm, unsigned short a){
+	(void)vm;
 #if defined(USE_TERMIOS)
 	putchar_unlocked(a);
 #else
 	putchar(a);
 #endif
 }
+#if defined(USE_TERMIOS)
+/*
+	Is there a character for gch? stdio may already have it, so this tries to read one without blocking and puts it back.
+	At the end of the input there always is one, the EOF.
+*/
+static int sisa_con_pending(sisa_vm* vm){
+	int fl = fcntl(STDIN_FILENO, F_GETFL, 0);
+	int ch;
+	(void)vm;
+	if(fl == -1) return 1;
+	fcntl(STDIN_FILENO, F_SETFL, fl | O_NONBLOCK);
+	ch = getchar_unlocked();
+	fcntl(STDIN_FILENO, F_SETFL, fl);
+	if(ch != EOF){ungetc(ch, stdin); return 1;}
+	if(feof(stdin)) return 1;
+	clearerr(stdin);
+	return 0;
+}
+/*Did gch find nothing, rather than a character? With 0xE000's O_NONBLOCK, EOF without the end of the input.*/
+static int sisa_con_none(sisa_vm* vm, U ch){
+	(void)vm;
+	if(ch != 0xffFF || feof(stdin)) return 0;
+	clearerr(stdin);
+	return 1;
+}
+/*Up to n characters which have already come in.*/
+static UU sisa_con_getn(sisa_vm* vm, u* buf, UU n){
+	int fl = fcntl(STDIN_FILENO, F_GETFL, 0);
+	UU i = 0;
+	int ch;
+	(void)vm;
+	if(fl != -1) fcntl(STDIN_FILENO, F_SETFL, fl | O_NONBLOCK);
+	while(i < n && (ch = getchar_unlocked()) != EOF) buf[i++] = ch;
+	if(fl != -1) fcntl(STDIN_FILENO, F_SETFL, fl);
+	if(!feof(stdin)) clearerr(stdin);
+	return i;
+}
+/*Sleep for ms milliseconds, or until a character comes in if input is set.*/
+static void sisa_con_idle(sisa_vm* vm, UU ms, int input){
+	struct pollfd pfd;
+	(void)vm;
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	poll(&pfd, input ? 1 : 0, (int)ms);
+}
+#else
+/*There is no telling, so there always is one, which getchar will wait for.*/
+static int sisa_con_pending(sisa_vm* vm){(void)vm; return 1;}
+static UU sisa_con_getn(sisa_vm* vm, u* buf, UU n){(void)vm; return sisa_stdio_getn(buf, n);}
+static int sisa_con_none(sisa_vm* vm, U ch){(void)vm; (void)ch; return 0;}
+/*Nor any way of sleeping in plain C, so this spins, as programs did before.*/
+static void sisa_con_idle(sisa_vm* vm, UU ms, int input){
+	clock_t end = clock() + (clock_t)(ms * (double)CLOCKS_PER_SEC / 1000);
+	(void)vm; (void)input;
+	while(clock() < end && !sisa_quit(vm->dev));
+}
+#endif
 #endif
 
 
 
 
 
-static unsigned short DONT_WANT_TO_INLINE_THIS interrupt(unsigned short a,
-									unsigned short b,
-									unsigned short c,
-									unsigned short stack_pointer,
-									unsigned short program_counter,
-									unsigned char program_counter_region,
-									UU RX0,
-									UU RX1,
-									UU RX2,
-									UU RX3,
-									u* M
-								)
-{
-	if(a == 0x80) return 0x80; /*Ignore 80- it is reserved for system calls!*/
-	if(a == 0) return 0;
+/*
+	Driver state for a freshly created VM.
+*/
+static struct sisa_dev* sisa_dev_new(){
+	struct sisa_dev* dv = calloc(1, sizeof(struct sisa_dev));
+	if(!dv) return NULL;
+	dv->disk_name = "sisa16.dsk";
+#ifdef USE_DISK_MMAP
+	dv->disk.fd = -1;
+	dv->base.fd = -1;
+#endif
+#ifdef USE_THREADS
+	pthread_mutex_init(&dv->aio_lock, NULL);
+	pthread_cond_init(&dv->aio_go, NULL);
+	pthread_cond_init(&dv->aio_fin, NULL);
+#endif
 #ifdef USE_SDL2
-	if(a == '\n' || a == '\r'){ /*magic values to display the screen.*/
-		UU i = 0;
-		SDL_Rect screenrect;
-		SDL_Rect screenrect2;
-		/*
-			B holds the process whose memory we want to use.
-		*/
-		b %= (SISA_MAX_TASKS+1);
-		screenrect.x = 0;
-		screenrect.y = 0;
-		screenrect.w = 8 * SCREEN_WIDTH_CHARS;
-		screenrect.h = 8 * SCREEN_HEIGHT_CHARS;
-		screenrect2 = screenrect;
-		screenrect2.w *= display_scale;
-		screenrect2.h *= display_scale;
-		for(i=0;i<(64 * SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS);i++){
-			unsigned char val = M_SAVER[active_audio_user][0xB00000 + i];
-			SDL_targ[i] = vga_palette[val];
+	dv->blocking_input = 1;
+	dv->screen_stale = 1;
+	dv->FG_color = 15;
+	memcpy(dv->vga_palette, vga_palette_default, sizeof(dv->vga_palette));
+	memset(dv->span_first, SCREEN_WIDTH_CHARS, sizeof(dv->span_first));
+#endif
+#ifdef SISA_SDL_THREAD
+	pthread_mutex_init(&dv->gfx_lock, NULL);
+	pthread_cond_init(&dv->gfx_go, NULL);
+	pthread_cond_init(&dv->gfx_input, NULL);
+#endif
+	return dv;
+}
+static void sisa_aio_free(struct sisa_dev* dv);
+static void sisa_img_close(struct sisa_img* im);
+#ifdef USE_SDL2
+static void sisa_audio_let_go(struct sisa_dev* dv);
+#endif
+static void sisa_dev_free(struct sisa_dev* dv){
+	if(!dv) return;
+	sisa_aio_free(dv);
+#ifdef SISA_SDL_THREAD
+	sisa_sdl_stop(dv);
+	pthread_cond_destroy(&dv->gfx_input);
+	pthread_cond_destroy(&dv->gfx_go);
+	pthread_mutex_destroy(&dv->gfx_lock);
+#endif
+#ifdef USE_DISK_MMAP
+	if(dv->disk.map) dv->disk_bits = NULL; /*it's in the mapping*/
+#endif
+	free(dv->disk_bits);
+	sisa_img_close(&dv->disk);
+	sisa_img_close(&dv->base);
+#ifdef USE_SDL2
+	sisa_audio_let_go(dv); /*the audio device is closed by now*/
+#endif
+	free(dv);
+}
+
+/*
+	The disk.
+	The image is opened the first time it is used, and stays open until the VM is freed.
+	Where it can be, the whole DISK_ACCESS_MASK range of it is mapped, pages are copied in and out of the mapping,
+	and the file is grown when a write goes past its end. Otherwise it goes through stdio, flushing after every write.
+	Growing never writes the pages in between, so a write anywhere on the disk costs the same.
+	Either way, writes are in the host's page cache as soon as the interrupt returns, and only 0xFF12 waits for them to hit the disk.
+	A missing image reads as zeroes, and past the end of it as 0xFF, as they always have.
+
+	With a base image, disk_name is an overlay on it, so that any number of VMs can share one read-only image.
+	The overlay holds the pages written, at the same offsets, sparse, followed by a bitmap of which ones those are.
+	Every other page is read from the base.
+*/
+#define DISK_BITS ((DISK_ACCESS_MASK + 1) >> 11)
+
+/*mode is 0 to only read, 1 to write as well, 2 to create it too. len is how much to map.*/
+static int sisa_img_open(struct sisa_img* im, const char* name, int mode, size_t len){
+#ifdef USE_DISK_MMAP
+	struct stat st;
+	void* p;
+	int fd;
+	if(im->map) return 1;
+#endif
+	if(im->f) return 1;
+#ifdef USE_DISK_MMAP
+	fd = open(name, mode == 2 ? (O_RDWR | O_CREAT) : mode ? O_RDWR : O_RDONLY, 0666);
+	if(fd < 0) return 0;
+	p = fstat(fd, &st) ? MAP_FAILED : mmap(NULL, len, mode ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	if(p != MAP_FAILED){
+		im->fd = fd;
+		im->map = p;
+		im->len = len;
+		im->size = st.st_size;
+		return 1;
+	}
+	close(fd); /*Not enough address space, probably. Fall back to stdio.*/
+#else
+	(void)len;
+#endif
+	im->f = fopen(name, mode ? "rb+" : "rb");
+	if(!im->f && mode == 2) im->f = fopen(name, "wb+");
+	return im->f != NULL;
+}
+static void sisa_img_close(struct sisa_img* im){
+#ifdef USE_DISK_MMAP
+	if(im->map){
+		munmap(im->map, im->len);
+		close(im->fd);
+	}
+#endif
+	if(im->f) fclose(im->f);
+}
+/*Page at (a byte offset, already masked) into pg. Returns 0 if there's no image.*/
+static int sisa_img_read(struct sisa_img* im, size_t at, u* pg){
+	size_t n = 0;
+#ifdef USE_DISK_MMAP
+	if(im->map){
+		if(at < im->size) n = im->size - at < 256 ? im->size - at : 256;
+		memcpy(pg, im->map + at, n);
+		memset(pg + n, 0xff, 256 - n);
+		return 1;
+	}
+#endif
+	if(!im->f || fseek(im->f, at, SEEK_SET)){memset(pg, 0, 256); return 0;}
+	n = fread(pg, 1, 256, im->f);
+	memset(pg + n, 0xff, 256 - n);
+	return 1;
+}
+/*n bytes to at. Returns 0 if they could not be written.*/
+static int sisa_img_write(struct sisa_img* im, size_t at, const u* p, size_t n){
+#ifdef USE_DISK_MMAP
+	if(im->map){
+		if(at + n > im->size){
+			if(ftruncate(im->fd, at + n)) return 0;
+			im->size = at + n;
 		}
-		for(i=0;i<(SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS);i++){
-			if(stdout_buf[i] && stdout_buf[i] != ' ' && isprint(stdout_buf[i]))
-				renderchar(font8x8_basic[stdout_buf[i]], i);
+		memcpy(im->map + at, p, n);
+		return 1;
+	}
+#endif
+	/*Past the end, the host fills the gap with zeroes, as a hole where the filesystem has them.*/
+	if(fseek(im->f, at, SEEK_SET)) return 0;
+	if(fwrite(p, 1, n, im->f) != n) return 0;
+	return fflush(im->f) == 0;
+}
+static int sisa_disk_open(struct sisa_dev* dv, int create){
+	if(!dv->disk_base) return sisa_img_open(&dv->disk, dv->disk_name, create ? 2 : 1, DISK_ACCESS_MASK + 1);
+	if(dv->disk_bits) return 1;
+	/*The overlay is made as soon as anything is read, it costs nothing until it's written to.*/
+	if(!sisa_img_open(&dv->disk, dv->disk_name, 2, DISK_ACCESS_MASK + 1 + DISK_BITS)) return 0;
+	sisa_img_open(&dv->base, dv->disk_base, 0, DISK_ACCESS_MASK + 1); /*A missing base reads as zeroes.*/
+#ifdef USE_DISK_MMAP
+	if(dv->disk.map){
+		if(dv->disk.size < dv->disk.len){
+			if(ftruncate(dv->disk.fd, dv->disk.len)) return 0;
+			dv->disk.size = dv->disk.len;
 		}
-		/*
-			TODO:
-			render characters.
-		*/
-		SDL_UpdateTexture(
-			sdl_tex,
-			NULL,
-			SDL_targ, 
-			(SCREEN_WIDTH_CHARS*8) * 4
-		);
-		SDL_RenderCopy(
-			sdl_rend, 
-			sdl_tex,
-			&screenrect,
-			&screenrect2
-		);
-		SDL_RenderPresent(sdl_rend);
-		return a;
+		dv->disk_bits = dv->disk.map + DISK_ACCESS_MASK + 1;
+		return 1;
+	}
+#endif
+	dv->disk_bits = calloc(1, DISK_BITS);
+	if(!dv->disk_bits) return 0;
+	/*A fresh overlay doesn't reach that far, and has no pages yet.*/
+	if(!fseek(dv->disk.f, DISK_ACCESS_MASK + 1, SEEK_SET)) fread(dv->disk_bits, 1, DISK_BITS, dv->disk.f);
+	return 1;
+}
+static int sisa_disk_read(struct sisa_dev* dv, size_t at, u* pg){
+	if(!sisa_disk_open(dv, 0)){memset(pg, 0, 256); return 0;}
+	if(dv->disk_bits && !(dv->disk_bits[at >> 11] & (1 << ((at >> 8) & 7))))
+		return sisa_img_read(&dv->base, at, pg);
+	return sisa_img_read(&dv->disk, at, pg);
+}
+/*pg to the page at at. Returns 0 if it could not be written.*/
+static int sisa_disk_write(struct sisa_dev* dv, size_t at, const u* pg){
+	u* bits;
+	if(!sisa_disk_open(dv, 1) || !sisa_img_write(&dv->disk, at, pg, 256)) return 0;
+	if(!dv->disk_bits) return 1;
+	bits = dv->disk_bits + (at >> 11);
+	if(*bits & (1 << ((at >> 8) & 7))) return 1;
+	*bits |= 1 << ((at >> 8) & 7);
+#ifdef USE_DISK_MMAP
+	if(dv->disk.map) return 1;
+#endif
+	/*The page went in first, so a crash can't leave the bitmap pointing at a page that isn't there.*/
+	return sisa_img_write(&dv->disk, DISK_ACCESS_MASK + 1 + (at >> 11), bits, 1);
+}
+/*Wait until everything written is on the disk. Returns 0 if it could not be.*/
+static int sisa_disk_sync(struct sisa_dev* dv){
+#ifdef USE_DISK_MMAP
+	if(dv->disk.map) return !dv->disk.size || !msync(dv->disk.map, dv->disk.size, MS_SYNC);
+#endif
+	if(dv->disk.f) return fflush(dv->disk.f) == 0;
+	return 1;
+}
+/*
+	Multi-page transfers, for 0xFF13 to 0xFF16, and the console's 0xE002 and 0xE003.
+	RX2 picks the memory: 0 for the caller's own, or task t's when the kernel asks, so that the kernel
+	can move a whole file or string in or out of a user task without bouncing it through its own pages.
+	Returns NULL if that task has no memory. The task the memory belongs to goes in *t.
+*/
+static sisa_mem sisa_dev_target(sisa_vm* vm, const sisa_irq* q, UU* t){
+	*t = q->t;
+	if(!q->RX2 || q->t) return q->M;
+	if(q->RX2 > vm->ntasks) return NULL;
+	*t = q->RX2;
+	return vm->M_SAVER[q->RX2];
+}
+/*
+	n pages between disk page at and memory page pg of MM, pg wrapping around at the end of memory.
+	A run which would go past the end of the disk isn't started. Returns 0 unless every page went through.
+*/
+static int sisa_disk_pages(sisa_vm* vm, sisa_mem MM, UU t, UU at, U pg, UU n, int write){
+	UU i;
+	int ok = 1;
+	if(!MM || at > (DISK_ACCESS_MASK >> 8) || n > (DISK_ACCESS_MASK >> 8) + 1 - at) return 0;
+	for(i = 0; i < n; i++, pg++){
+		size_t off = ((size_t)(at + i)) << 8;
+		if(write)
+			ok &= sisa_disk_write(vm->dev, off, sisa_mem_rp(MM, (UU)pg<<8));
+		else {
+			u* p = sisa_mem_wp(MM, (UU)pg<<8);
+			if(!p) return 0;
+			sisa_code_dirty(vm, t, (UU)pg<<8, 256);
+			ok &= sisa_disk_read(vm->dev, off, p);
+		}
+	}
+	return ok;
+}
+/*
+	n descriptors starting at page b of the caller's memory, eight bytes each, big endian:
+	disk page (4 bytes), memory page (2 bytes), number of pages (2 bytes).
+*/
+static int sisa_disk_list(sisa_vm* vm, sisa_mem M, sisa_mem MM, UU t, U b, UU n, int write){
+	UU d = (UU)b << 8;
+	int ok = 1;
+	for(; n; n--, d = (d + 8) & 0xffFFff){
+		UU at = ((UU)MEM_READ(M, d) << 24) | ((UU)MEM_READ(M, (d+1) & 0xffFFff) << 16)
+			| ((UU)MEM_READ(M, (d+2) & 0xffFFff) << 8) | MEM_READ(M, (d+3) & 0xffFFff);
+		U pg = ((U)MEM_READ(M, (d+4) & 0xffFFff) << 8) | MEM_READ(M, (d+5) & 0xffFFff);
+		UU cnt = ((UU)MEM_READ(M, (d+6) & 0xffFFff) << 8) | MEM_READ(M, (d+7) & 0xffFFff);
+		ok &= sisa_disk_pages(vm, MM, t, at, pg, cnt, write);
+	}
+	return ok;
+}
+
+/*
+	Asynchronous transfers.
+	0xFF17 queues a read and 0xFF18 a write of RX1 pages between disk page RX0 and memory page b, RX2 as for 0xFF13,
+	and they return a tag, or 0 if the transfer can't be queued. A write's pages are copied when it is queued,
+	and a read's land in memory when its tag is collected: 0xFF19 hands back the tag of a finished transfer,
+	or 0 if none has finished, and 0xFF1A waits for one if any are queued. 0x8000 is set in the tag if it failed.
+	So a read's pages keep what they had, even after it has finished, until 0xFF19 or 0xFF1A returns its tag,
+	and they are copied in then, by the same rules as 0xFF13 (shared regions are copied first, translated code is thrown away).
+	With USE_THREADS the transfers run on a thread of the device's own, in the order they were queued, while the VM
+	gets on with something else. The other disk interrupts wait for that queue to empty, so they never find the disk
+	half way through a transfer. Without threads a transfer is done as soon as it is queued.
+*/
+#define SISA_AIO_MAX 64
+
+typedef struct sisa_aio{
+	struct sisa_aio* next;
+	sisa_mem MM;
+	UU t; /*the task MM belongs to*/
+	UU at;
+	UU n;
+	U pg;
+	U tag;
+	u write;
+	u ok;
+	u data[1]; /*n pages*/
+}sisa_aio;
+
+#ifdef USE_THREADS
+#define SISA_AIO_LOCK(dv) pthread_mutex_lock(&(dv)->aio_lock);
+#define SISA_AIO_UNLOCK(dv) pthread_mutex_unlock(&(dv)->aio_lock);
+#else
+#define SISA_AIO_LOCK(dv) /*a comment*/
+#define SISA_AIO_UNLOCK(dv) /*a comment*/
+#endif
+
+static void sisa_aio_run(struct sisa_dev* dv, sisa_aio* r){
+	UU i;
+	r->ok = 1;
+	for(i = 0; i < r->n; i++){
+		size_t off = ((size_t)(r->at + i)) << 8;
+		if(r->write) r->ok &= sisa_disk_write(dv, off, r->data + ((size_t)i << 8));
+		else r->ok &= sisa_disk_read(dv, off, r->data + ((size_t)i << 8));
+	}
+}
+static void sisa_aio_finish(struct sisa_dev* dv, sisa_aio* r){
+	r->next = NULL;
+	if(dv->aio_done_last) dv->aio_done_last->next = r; else dv->aio_done = r;
+	dv->aio_done_last = r;
+}
+#ifdef USE_THREADS
+static void* sisa_aio_worker(void* arg){
+	struct sisa_dev* dv = arg;
+	pthread_mutex_lock(&dv->aio_lock);
+	for(;;){
+		sisa_aio* r;
+		while(!dv->aio_todo && !dv->aio_quit) pthread_cond_wait(&dv->aio_go, &dv->aio_lock);
+		if(!dv->aio_todo) break; /*Whatever was queued still gets written before quitting.*/
+		r = dv->aio_todo; /*stays queued until it is done, for sisa_aio_drain*/
+		pthread_mutex_unlock(&dv->aio_lock);
+		sisa_aio_run(dv, r);
+		pthread_mutex_lock(&dv->aio_lock);
+		dv->aio_todo = r->next;
+		if(!dv->aio_todo) dv->aio_todo_last = NULL;
+		sisa_aio_finish(dv, r);
+		pthread_cond_broadcast(&dv->aio_fin);
+	}
+	pthread_mutex_unlock(&dv->aio_lock);
+	return NULL;
+}
+#endif
+/*Wait for the queue to empty.*/
+static void sisa_aio_drain(struct sisa_dev* dv){
+#ifdef USE_THREADS
+	if(!dv->aio_started) return;
+	pthread_mutex_lock(&dv->aio_lock);
+	while(dv->aio_todo) pthread_cond_wait(&dv->aio_fin, &dv->aio_lock);
+	pthread_mutex_unlock(&dv->aio_lock);
+#else
+	(void)dv;
+#endif
+}
+static void sisa_aio_free(struct sisa_dev* dv){
+	sisa_aio* r;
+#ifdef USE_THREADS
+	if(dv->aio_started){
+		pthread_mutex_lock(&dv->aio_lock);
+		dv->aio_quit = 1;
+		pthread_cond_signal(&dv->aio_go);
+		pthread_mutex_unlock(&dv->aio_lock);
+		pthread_join(dv->aio_th, NULL);
+	}
+	pthread_cond_destroy(&dv->aio_fin);
+	pthread_cond_destroy(&dv->aio_go);
+	pthread_mutex_destroy(&dv->aio_lock);
+#endif
+	while((r = dv->aio_done)){dv->aio_done = r->next; free(r);}
+}
+static U sisa_aio_submit(sisa_vm* vm, sisa_mem MM, UU t, UU at, U pg, UU n, int write){
+	struct sisa_dev* dv = vm->dev;
+	sisa_aio* r;
+	UU i;
+	if(!MM || !n || n > 0x10000 || dv->aio_count >= SISA_AIO_MAX) return 0;
+	if(at > (DISK_ACCESS_MASK >> 8) || n > (DISK_ACCESS_MASK >> 8) + 1 - at) return 0;
+	r = malloc(sizeof(sisa_aio) - 1 + ((size_t)n << 8));
+	if(!r) return 0;
+	r->next = NULL;
+	r->MM = MM;
+	r->t = t;
+	r->at = at;
+	r->n = n;
+	r->pg = pg;
+	r->write = write;
+	r->ok = 0;
+	if(write)
+		for(i = 0; i < n; i++)
+			memcpy(r->data + ((size_t)i << 8), sisa_mem_rp(MM, (UU)(U)(pg + i) << 8), 256);
+	dv->aio_tag = dv->aio_tag % 0x7fFF + 1;
+	r->tag = dv->aio_tag;
+	dv->aio_count++;
+#ifdef USE_THREADS
+	if(!dv->aio_started) dv->aio_started = !pthread_create(&dv->aio_th, NULL, sisa_aio_worker, dv);
+	if(dv->aio_started){
+		pthread_mutex_lock(&dv->aio_lock);
+		if(dv->aio_todo_last) dv->aio_todo_last->next = r; else dv->aio_todo = r;
+		dv->aio_todo_last = r;
+		pthread_cond_signal(&dv->aio_go);
+		pthread_mutex_unlock(&dv->aio_lock);
+		return r->tag;
+	}
+#endif
+	sisa_aio_run(dv, r);
+	sisa_aio_finish(dv, r);
+	return r->tag;
+}
+static U sisa_aio_collect(sisa_vm* vm, int wait){
+	struct sisa_dev* dv = vm->dev;
+	sisa_aio* r;
+	U tag;
+	UU i;
+	SISA_AIO_LOCK(dv)
+#ifdef USE_THREADS
+	while(wait && !dv->aio_done && dv->aio_todo) pthread_cond_wait(&dv->aio_fin, &dv->aio_lock);
+#else
+	(void)wait;
+#endif
+	r = dv->aio_done;
+	if(r){
+		dv->aio_done = r->next;
+		if(!dv->aio_done) dv->aio_done_last = NULL;
+	}
+	SISA_AIO_UNLOCK(dv)
+	if(!r) return 0;
+	dv->aio_count--;
+	if(!r->write)
+		for(i = 0; i < r->n; i++){
+			UU addr = (UU)(U)(r->pg + i) << 8;
+			u* p = sisa_mem_wp(r->MM, addr);
+			if(!p){r->ok = 0; break;}
+			sisa_code_dirty(vm, r->t, addr, 256);
+			memcpy(p, r->data + ((size_t)i << 8), 256);
+		}
+	tag = r->tag | (r->ok ? 0 : 0x8000);
+	free(r);
+	return tag;
+}
+
+/*
+	The driver's devices, which sisa_dev_attach puts on the bus.
+*/
+#ifdef USE_SDL2
+/*
+	'\n' and '\r' display the screen.
+	Each row of the framebuffer is compared with what was shown, and only the tiles which differ there,
+	or in the character on them, are drawn and sent to the texture again, a span of them per row of tiles.
+*/
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_screen(sisa_vm* vm, const sisa_irq* q, void* user){
+	struct sisa_dev* dv = vm->dev;
+	sisa_mem MM = vm->M_SAVER[dv->active_audio_user];
+	u dirty[SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS];
+	u row[SCREEN_WIDTH_CHARS * 8];
+	UU i, x, y;
+	int full = dv->screen_stale;
+	(void)user;
+	dv->screen_stale = 0;
+	memset(dirty, full, sizeof(dirty));
+	for(y = 0; y < SCREEN_HEIGHT_CHARS * 8; y++){
+		UU at = SCREEN_LOC + y * SCREEN_WIDTH_CHARS * 8;
+		u* was = dv->shown_fb + y * SCREEN_WIDTH_CHARS * 8;
+		const u* now = sisa_mem_rp(MM, at);
+		UU len = 0x10000 - (at & 0xffFF);
+		if(len < sizeof(row)){ /*Sparse memory is only contiguous within a region.*/
+			memcpy(row, now, len);
+			memcpy(row + len, sisa_mem_rp(MM, at + len), sizeof(row) - len);
+			now = row;
+		}
+		if(!full && !memcmp(was, now, sizeof(row))) continue;
+		for(x = 0; x < SCREEN_WIDTH_CHARS; x++)
+			if(full || memcmp(was + x * 8, now + x * 8, 8)){
+				memcpy(was + x * 8, now + x * 8, 8);
+				dirty[(y / 8) * SCREEN_WIDTH_CHARS + x] = 1;
+			}
+	}
+	for(i = 0; i < SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS; i++){
+		unsigned char ch = dv->stdout_buf[i];
+		if(ch == ' ' || !isprint(ch)) ch = 0;
+		if(ch != dv->shown_text[i]){dv->shown_text[i] = ch; dirty[i] = 1;}
+	}
+	SISA_GFX_LOCK(dv)
+	for(y = 0; y < SCREEN_HEIGHT_CHARS; y++){
+		for(x = 0; x < SCREEN_WIDTH_CHARS; x++){
+			i = y * SCREEN_WIDTH_CHARS + x;
+			if(!dirty[i]) continue;
+			rendertile(dv, i);
+			if(dv->shown_text[i]) renderchar(dv, font8x8_basic[dv->shown_text[i]], i);
+			if(dv->span_first[y] > x) dv->span_first[y] = x;
+			if(dv->span_last[y] < x) dv->span_last[y] = x;
+		}
+	}
+	if(dv->headless) sisa_headless_frame(dv);
+#ifdef SISA_SDL_THREAD
+	else{
+		dv->gfx_frame = 1;
+		pthread_cond_signal(&dv->gfx_go);
+	}
+	pthread_mutex_unlock(&dv->gfx_lock);
+#else
+	else sisa_sdl_upload(dv->SDL_targ, dv->span_first, dv->span_last);
+#endif
+	return q->a;
+}
+/*
+	Headless, nothing plays the ring, so it is taken off at the rate a real device would, 32000 bytes a second,
+	after what is left of interrupt 3's samples, same as the callback.
+*/
+static void sisa_audio_drain(struct sisa_dev* dv){
+	sisa_u64 now = sisa_now_ns();
+	UU tail = sisa_atomic_get(&dv->ring_tail);
+	UU n = (UU)sisa_atomic_get(&dv->ring_head) - tail;
+	int on = sisa_atomic_get(&dv->ring_on);
+	UU due;
+	if(!n && !on && !dv->audio_left){dv->ring_clock = now; return;}
+	due = (UU)((now - dv->ring_clock) / 31250) & ~(UU)1;
+	if(!due) return;
+	dv->ring_clock += (sisa_u64)due * 31250;
+	if(dv->audio_left){
+		UU shot = due < dv->audio_left ? due : dv->audio_left;
+		dv->audio_left -= shot;
+		due -= shot;
+		if(!due) return;
 	}
-	if(a == 1){ /*Poll events.*/
-		pollevents();
-		return shouldquit;
+	if(due > n){
+		if(on) sisa_atomic_add(&dv->ring_underruns, 1);
+		due = n;
+		dv->ring_clock = now;
 	}
-	if(a == 2){ /*Read gamer buttons!!!!*/
+	sisa_atomic_set(&dv->ring_tail, tail + due);
+}
+/*Let go of the regions interrupt 3 played from. The callback must not be running.*/
+static void sisa_audio_let_go(struct sisa_dev* dv){
+	UU i;
+	for(i = 0; i < SISA_AUDIO_SHOT >> 16; i++){
+#ifdef USE_SPARSE_MEMORY
+		if(dv->audio_shot[i]){
+			SISA_MEM_LOCK()
+			sisa_region_drop(dv->audio_shot[i]);
+			SISA_MEM_UNLOCK()
+		}
+#endif
+		dv->audio_shot[i] = NULL;
+	}
+}
+/*Hold on to the regions interrupt 3 is about to play from. The callback must not be running.*/
+static void sisa_audio_hold(sisa_vm* vm){
+	struct sisa_dev* dv = vm->dev;
+	sisa_mem MM = vm->M_SAVER[dv->active_audio_user];
+	UU i;
+	sisa_audio_let_go(dv);
+	for(i = 0; i < SISA_AUDIO_SHOT >> 16; i++){
+		dv->audio_shot[i] = sisa_mem_rp(MM, SISA_AUDIO_AT + (i << 16));
+#ifdef USE_SPARSE_MEMORY
+		SISA_MEM_LOCK()
+		if(dv->audio_shot[i] != sisa_zero_region) SISA_REGION_REFS(dv->audio_shot[i])++;
+		SISA_MEM_UNLOCK()
+#endif
+	}
+}
+/*Whole samples from addr of MM onto the ring, as many as fit.*/
+static U sisa_audio_append(struct sisa_dev* dv, sisa_mem MM, UU addr, UU n){
+	UU head = sisa_atomic_get(&dv->ring_head);
+	UU room = SISA_AUDIO_RING - (head - (UU)sisa_atomic_get(&dv->ring_tail));
+	UU done = 0;
+	if(!MM) return 0;
+	if(n > room) n = room;
+	n &= ~(UU)1;
+	while(done < n){
+		UU at = (addr + done) & 0xffFFff;
+		UU len = 0x10000 - (at & 0xffFF); /*Sparse memory is only contiguous within a region.*/
+		UU r = (head + done) % SISA_AUDIO_RING;
+		if(len > n - done) len = n - done;
+		if(len > SISA_AUDIO_RING - r) len = SISA_AUDIO_RING - r;
+		memcpy(dv->audio_ring + r, sisa_mem_rp(MM, at), len);
+		done += len;
+	}
+	sisa_atomic_set(&dv->ring_head, head + n); /*after the samples*/
+	sisa_atomic_set(&dv->ring_on, 1);
+	return n;
+}
+/*
+	Streamed audio, 16 bit big-endian mono samples at 16 kHz, which play after anything interrupt 3 started.
+*/
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_audio(sisa_vm* vm, const sisa_irq* q, void* user){
+	struct sisa_dev* dv = vm->dev;
+	UU t;
+	(void)user;
+	if(dv->headless) sisa_audio_drain(dv);
+	switch(q->a){
+	case 0xE020: /*Append RX1 bytes from RX0, RX2 as for the disk. Returns how many fit.*/
+		return sisa_audio_append(dv, sisa_dev_target(vm, q, &t), q->RX0, q->RX1);
+	case 0xE021: /*How many bytes would fit now.*/
+		return SISA_AUDIO_RING - ((UU)sisa_atomic_get(&dv->ring_head) - (UU)sisa_atomic_get(&dv->ring_tail));
+	case 0xE022:{ /*Underruns since the last time.*/
+		UU n = (UU)sisa_atomic_get(&dv->ring_underruns) - dv->ring_underruns_seen;
+		dv->ring_underruns_seen += n;
+		return n > 0xffFF ? 0xffFF : n;
+	}
+	}
+	return q->a;
+}
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_sdl(sisa_vm* vm, const sisa_irq* q, void* user){ /*1 to 8*/
+	struct sisa_dev* dv = vm->dev;
+	(void)user;
+	switch(q->a){
+	case 1: /*Poll events.*/
+		pollevents(vm);
+		return sisa_quit(vm->dev);
+	case 2:{ /*Read gamer buttons!!!!*/
 		unsigned short retval = 0;
 		const unsigned char *state;
-		SDL_PumpEvents();
+		if(dv->headless) return 0; /*no keyboard, so nothing is held*/
+#ifndef SISA_SDL_THREAD
+		SDL_PumpEvents(); /*otherwise the window thread does*/
+#endif
 		state = SDL_GetKeyboardState(NULL);
 		retval |= 0x1 * (state[SDL_SCANCODE_UP]!=0);
 		retval |= 0x2 * (state[SDL_SCANCODE_DOWN]!=0);
@@ -376,55 +1480,239 @@ static unsigned short DONT_WANT_TO_INLINE_THIS interrupt(unsigned short a,
 		return retval;
 	}
 	/*TODO: play samples from a buffer.*/
-	if(a == 3){
-		audio_left = 0xB0000;
+	case 3:
+		if(dv->headless) sisa_audio_drain(dv); /*up to now, before these start*/
+		else SDL_LockAudio();
+		sisa_audio_hold(vm);
+		dv->audio_left = SISA_AUDIO_SHOT;
+		if(!dv->headless) SDL_UnlockAudio();
 		return 1;
-	}
-	/*kill the audio.*/
-	if(a == 4){
-		audio_left = 0;
+	/*kill the audio, streamed too.*/
+	case 4:
+		if(!dv->headless) SDL_LockAudio();
+		dv->audio_left = 0;
+		sisa_audio_let_go(dv);
+		sisa_atomic_set(&dv->ring_tail, sisa_atomic_get(&dv->ring_head));
+		sisa_atomic_set(&dv->ring_on, 0);
+		if(!dv->headless) SDL_UnlockAudio();
 		return 1;
-	}
-	if(a == 5){
-		FG_color = b;
+	case 5:
+		dv->FG_color = q->b;
+		dv->screen_stale = 1;
 		return 1;
-	}
-	if(a == 6){
-		
+	case 6:
 		return 1;
+	case 7: /*They want to set the active user for audio.*/
+		dv->active_audio_user = q->b % (vm->ntasks+1);
+		if(!vm->M_SAVER[dv->active_audio_user]) dv->active_audio_user = 0; /*never picked by task_set*/
+		dv->screen_stale = 1;
+		return q->a;
+	case 8:
+		dv->vga_palette[q->b&0xff] = q->RX0 & 0xFFffFF;
+		dv->screen_stale = 1;
+		return q->a;
 	}
-	if(a == 7){ /*They want to set the active user for audio.*/
-		active_audio_user = b % (SISA_MAX_TASKS+1);
+	return q->a;
+}
+#endif
+/*
+	Strings, a whole one per interrupt rather than a putchar or getchar per character.
+	0xE002 writes from RX0 until a zero, or RX1 bytes, and returns how many it wrote.
+	That is in a, so it stops at 0xFFFF, and a longer string takes more than one.
+	0xE003 reads a line into RX0, at most RX1 bytes with the zero on the end, and returns its length.
+	The line ends at a return, a newline, a zero or anything past '~', none of which are kept,
+	and delete and backspace take back a character. If c is 1 it is echoed, as gets does.
+	0xE005 takes up to RX1 of the characters which have already come in, as they are, into RX0,
+	and returns how many. It doesn't wait, except without termios or SDL2, where it reads up to a newline.
+	RX2 as for 0xFF13. Addresses wrap around at the end of memory.
+*/
+static U sisa_con_write(sisa_vm* vm, sisa_mem MM, UU addr, UU n){
+	UU done = 0;
+	if(!MM) return 0;
+	if(n > 0xffFF) n = 0xffFF;
+	while(done < n){
+		UU at = (addr + done) & 0xffFFff;
+		UU len = 0x10000 - (at & 0xffFF); /*Sparse memory is only contiguous within a region.*/
+		const u* p = sisa_mem_rp(MM, at);
+		const u* z;
+		if(len > n - done) len = n - done;
+		z = memchr(p, 0, len);
+		if(z) len = z - p;
+#ifdef USE_SDL2
+		{UU i; for(i = 0; i < len; i++) pch(vm, p[i]);}
+#else
+		(void)vm;
+		fwrite(p, 1, len, stdout);
+#endif
+		done += len;
+		if(z) break;
 	}
-	if(a == 8){
-		vga_palette[b&0xff] = RX0 & 0xFFffFF;
+	return done;
+}
+static void sisa_con_show(sisa_vm* vm){
+#ifdef USE_SDL2
+	sisa_irq q;
+	q.a = '\n';
+	sisa_dev_screen(vm, &q, NULL);
+#else
+	(void)vm;
+	fflush(stdout);
+#endif
+}
+static U sisa_con_take(sisa_vm* vm, sisa_mem MM, UU t, UU addr, UU n){
+	UU done = 0;
+	if(!MM) return 0;
+	if(n > 0xffFF) n = 0xffFF;
+	while(done < n){
+		u buf[256];
+		UU want = n - done < sizeof(buf) ? n - done : sizeof(buf);
+		UU got = sisa_con_getn(vm, buf, want);
+		UU i;
+		for(i = 0; i < got; i++){
+			UU at = (addr + done + i) & 0xffFFff;
+			u* p = sisa_mem_wp(MM, at);
+			if(!p) return done + i;
+			sisa_code_dirty(vm, t, at, 1);
+			*p = buf[i];
+		}
+		done += got;
+		if(got < want || buf[got - 1] == '\n') break; /*that was all, or all the line*/
 	}
+	return done;
+}
+static U sisa_con_read(sisa_vm* vm, sisa_mem MM, UU t, UU addr, UU n, int echo){
+	UU len = 0;
+	u* p;
+	if(!MM || !n) return 0;
+	for(;;){
+		U ch;
+		sisa_con_show(vm);
+		if(len + 1 >= n) break;
+		ch = gch(vm);
+		if(sisa_quit(vm->dev)) break;
+		if(sisa_con_none(vm, ch)){ /*non-blocking, and nothing typed yet*/
+			sisa_con_idle(vm, 16, 1);
+			continue;
+		}
+		if(ch == 0x7f || ch == '\b'){
+			if(!len) continue;
+			len--;
+			if(echo){
+#ifdef USE_SDL2
+				pch(vm, 0x7f);
 #else
-	if(a == 1){
-		return shouldquit;
+				pch(vm, '\b'); pch(vm, ' '); pch(vm, '\b');
+#endif
+			}
+			continue;
+		}
+		if(ch == 0 || ch == '\r' || ch == '\n' || ch > '~') break;
+		p = sisa_mem_wp(MM, (addr + len) & 0xffFFff);
+		if(!p) break;
+		sisa_code_dirty(vm, t, (addr + len) & 0xffFFff, 1);
+		*p = ch;
+		len++;
+		if(echo) pch(vm, ch);
+	}
+	p = sisa_mem_wp(MM, (addr + len) & 0xffFFff);
+	if(p){
+		sisa_code_dirty(vm, t, (addr + len) & 0xffFFff, 1);
+		*p = 0;
+	}
+	return len;
+}
+/*
+	0xE004 sleeps, without spinning, until b milliseconds are up or something bit 0, 1 or 2 of c asks for happens:
+	bit 0 a character to read, bit 1 a queued disk transfer finishing, for 0xFF19 to collect,
+	bit 2 the timer's deadline going off, which 0xE012 then doesn't report again.
+	Returns which of those it was, as the same bits, or 0 if the time ran out.
+	While a transfer is still on the device's thread, waiting for both at once goes round every SISA_WAIT_SLICE milliseconds.
+*/
+#define SISA_WAIT_INPUT 1
+#define SISA_WAIT_DISK 2
+#define SISA_WAIT_TIMER 4
+#define SISA_WAIT_SLICE 1
+static U sisa_con_wait(sisa_vm* vm, UU ms, U want){
+	struct sisa_dev* dv = vm->dev;
+	sisa_con_show(vm);
+	for(;;){
+		U got = 0;
+		UU step = ms;
+		int busy;
+		SISA_AIO_LOCK(dv)
+		if(dv->aio_done) got |= SISA_WAIT_DISK;
+		busy = dv->aio_todo != NULL;
+		SISA_AIO_UNLOCK(dv)
+		got &= want;
+		if((want & SISA_WAIT_INPUT) && sisa_con_pending(vm)) got |= SISA_WAIT_INPUT;
+		if((want & SISA_WAIT_TIMER) && (sisa_timer_due(vm) || vm->timer_fired)){
+			vm->timer_fired = 0;
+			got |= SISA_WAIT_TIMER;
+		}
+		if(got || !ms || sisa_quit(dv)) return got;
+		if((want & SISA_WAIT_TIMER) && vm->timer_at){
+			sisa_u64 now = sisa_now_ns();
+			sisa_u64 left = vm->timer_at > now ? (vm->timer_at - now + 999999) / 1000000 : 0;
+			if(left < step) step = left;
+		}
+		if((want & SISA_WAIT_DISK) && busy){
+#ifdef USE_THREADS
+			if(!(want & SISA_WAIT_INPUT)){
+				struct timespec ts;
+				int woke;
+				sisa_time_after(&ts, step);
+				pthread_mutex_lock(&dv->aio_lock);
+				while(!dv->aio_done && dv->aio_todo)
+					if(pthread_cond_timedwait(&dv->aio_fin, &dv->aio_lock, &ts)) break;
+				woke = dv->aio_done != NULL;
+				pthread_mutex_unlock(&dv->aio_lock);
+				if(!woke) ms -= step;
+				continue;
+			}
+#endif
+			if(step > SISA_WAIT_SLICE) step = SISA_WAIT_SLICE;
+		}
+		sisa_con_idle(vm, step, want & SISA_WAIT_INPUT);
+		ms -= step;
 	}
+}
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_console(sisa_vm* vm, const sisa_irq* q, void* user){
+#ifdef USE_SDL2
+	struct sisa_dev* dv = vm->dev;
 #endif
-
-	if(a==0xa||a == 0xd) {
+	sisa_mem MM;
+	UU t;
+	(void)user;
+	switch(q->a){
+	case 0xE002:
+		return sisa_con_write(vm, sisa_dev_target(vm, q, &t), q->RX0, q->RX1);
+	case 0xE003:
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_con_read(vm, MM, t, q->RX0, q->RX1, q->c == 1);
+	case 0xE004:
+		return sisa_con_wait(vm, q->b, q->c);
+	case 0xE005:
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_con_take(vm, MM, t, q->RX0, q->RX1);
 #ifndef USE_SDL2
+	case 1:
+		return sisa_quit(vm->dev);
+	case 0xa: case 0xd:
 		fflush(stdout);
+		return q->a;
 #endif
-		return a;
-	}
-	if(a == 0xc){
+	case 0xc:
 #ifdef USE_SDL2
-		memset(stdout_buf, 0, SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS);
-		curpos = 0;
+		memset(dv->stdout_buf, 0, SCREEN_WIDTH_CHARS * SCREEN_HEIGHT_CHARS);
+		dv->curpos = 0;
 #else
 		printf("\e[H\e[2J\e[3J");
 #endif
-		return a;
-	}
-
-	if(a==0xE000){
+		return q->a;
+	case 0xE000:
 #ifdef USE_SDL2
 #ifndef SDL2_NO_EMULATE_BLOCKING_INPUT
-		blocking_input = 0;
+		dv->blocking_input = 0;
 #endif
 		return 1;
 #else
@@ -435,12 +1723,11 @@ static unsigned short DONT_WANT_TO_INLINE_THIS interrupt(unsigned short a,
 		return 0;
 #endif
 #endif
-	}
-	if(a==0xE001){
+	case 0xE001:
 #ifdef USE_SDL2
 
 #ifndef SDL2_NO_EMULATE_BLOCKING_INPUT
-		blocking_input = 1;
+		dv->blocking_input = 1;
 		return 1;
 #else
 		return 0;
@@ -457,66 +1744,119 @@ static unsigned short DONT_WANT_TO_INLINE_THIS interrupt(unsigned short a,
 
 #endif
 	}
-	if(a == 0xffFF){ /*Perform a memory dump.*/
-		unsigned long i,j;
-		for(i=0;i<(1<<24)-31;i+=32)
-			for(j=i,printf("%s\r\n%06lx|",(i&255)?"":"\r\n~",i);j<i+32;j++)
-					printf("%02x%c",M[j],((j+1)%8)?' ':'|');
-		return a;
-	}
-	if(a == 0xFF10){ /*Read 256 bytes from saved disk.*/
-		size_t location_on_disk = ((size_t)RX0) << 8;
-		FILE* f = fopen("sisa16.dsk", "rb+");
-		location_on_disk &= DISK_ACCESS_MASK;
-		if(!f){
-			UU i = 0;
-			for(i = 0; i < 256; i++){
-				M[((UU)b<<8) + i] = 0;
-			}
-			return 0;
-		}
-		if(fseek(f, location_on_disk, SEEK_SET)){
-			UU i = 0;
-			for(i = 0; i < 256; i++){
-				M[((UU)b<<8) + i] = 0;
-			}
-			return 0;
-		}
-		{
-			UU i = 0;
-			for(i = 0; i < 256; i++){
-				M[((UU)b<<8) + i] = fgetc(f);
-			}
+	return q->a;
+}
+/*
+	The timer.
+	0xE010 stores the time on a monotonic clock in nanoseconds, then how many instructions have been run (see SISA_RETIRE),
+	8 bytes each, most significant first, at RX0. RX2 as for 0xFF13. Returns 0 if that memory isn't there.
+	0xE011 sets a deadline RX0 microseconds from now, or takes it away if RX0 is 0. It goes off once,
+	pre-empting whichever user task is running as if its slice had run out, and waking 0xE004 if it is asked to.
+	0xE012 returns 1 if it went off since the last time anyone asked, and 0 if it didn't.
+*/
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_timer(sisa_vm* vm, const sisa_irq* q, void* user){
+	(void)user;
+	switch(q->a){
+	case 0xE010:{
+		UU i, t;
+		sisa_mem MM = sisa_dev_target(vm, q, &t);
+		sisa_u64 v[2];
+		if(!MM) return 0;
+		v[0] = sisa_now_ns();
+		v[1] = vm->insns;
+		for(i = 0; i < 16; i++){
+			UU at = (q->RX0 + i) & 0xffFFff;
+			u* p = sisa_mem_wp(MM, at);
+			if(!p) return 0;
+			sisa_code_dirty(vm, t, at, 1);
+			*p = v[i >> 3] >> (56 - 8 * (i & 7));
 		}
-		fclose(f);
 		return 1;
 	}
-
-	if(a == 0xFF11){ /*write 256 bytes from 'b' to saved disk.*/
-		size_t location_on_disk = ((size_t)RX0) << 8;
-		FILE* f = fopen("sisa16.dsk", "rb+");
-		location_on_disk &= DISK_ACCESS_MASK;
-		if(!f){
-			f = fopen("sisa16.dsk", "wb");
-			if(!f) return 0;
-			if((unsigned long)ftell(f) < (unsigned long)location_on_disk) if(EOF == fputc(0, f)) return 0;
-			fflush(f);
-			fclose(f);
-			f = fopen("sisa16.dsk", "rb+");
-			if(!f) return 0;
-		}
-		if(fseek(f, location_on_disk, SEEK_SET)){
-			fseek(f, 0, SEEK_END);
-			while((unsigned long)ftell(f) < (unsigned long)location_on_disk) if(EOF == fputc(0, f)) return 0;
-		}
-		{
-			UU i = 0;
-			for(i = 0; i < 256; i++){
-				fputc(M[((UU)b<<8) + i], f);
-			}
-		}
-		fclose(f);
+	case 0xE011:
+		vm->timer_at = q->RX0 ? sisa_now_ns() + (sisa_u64)q->RX0 * 1000 : 0;
+		vm->timer_fired = 0;
 		return 1;
+	case 0xE012:{
+		U fired;
+		sisa_timer_due(vm);
+		fired = vm->timer_fired;
+		vm->timer_fired = 0;
+		return fired;
+	}
 	}
-	return a;
+	return q->a;
+}
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_dump(sisa_vm* vm, const sisa_irq* q, void* user){ /*Perform a memory dump.*/
+	unsigned long i,j;
+	(void)vm; (void)user;
+	for(i=0;i<(1<<24)-31;i+=32)
+		for(j=i,printf("%s\r\n%06lx|",(i&255)?"":"\r\n~",i);j<i+32;j++)
+				printf("%02x%c",MEM_READ(q->M, j),((j+1)%8)?' ':'|');
+	return q->a;
+}
+static U DONT_WANT_TO_INLINE_THIS sisa_dev_disk(sisa_vm* vm, const sisa_irq* q, void* user){
+	sisa_mem M = q->M;
+	sisa_mem MM;
+	U b = q->b;
+	UU t;
+	(void)user;
+	if(q->a <= 0xFF16) sisa_aio_drain(vm->dev);
+	switch(q->a){
+	case 0xFF10:{ /*Read 256 bytes from saved disk into page b.*/
+		u* pg = sisa_mem_wp(M, (UU)b<<8);
+		if(!pg) return 0;
+		sisa_code_dirty(vm, q->t, (UU)b<<8, 256);
+		return sisa_disk_read(vm->dev, (((size_t)q->RX0) << 8) & DISK_ACCESS_MASK, pg);
+	}
+	case 0xFF11: /*write 256 bytes from page b to saved disk.*/
+		return sisa_disk_write(vm->dev, (((size_t)q->RX0) << 8) & DISK_ACCESS_MASK, sisa_mem_rp(M, (UU)b<<8));
+	case 0xFF12: /*Make sure whatever was written to the disk is really on it.*/
+		return sisa_disk_sync(vm->dev);
+	case 0xFF13: /*Read RX1 pages from the disk, starting at page RX0, into pages b onwards. RX2 as above.*/
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_disk_pages(vm, MM, t, q->RX0, b, q->RX1, 0);
+	case 0xFF14: /*Write RX1 pages from pages b onwards to the disk, starting at page RX0.*/
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_disk_pages(vm, MM, t, q->RX0, b, q->RX1, 1);
+	case 0xFF15: /*Read by the RX1 descriptors at page b.*/
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_disk_list(vm, M, MM, t, b, q->RX1, 0);
+	case 0xFF16: /*Write by the RX1 descriptors at page b.*/
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_disk_list(vm, M, MM, t, b, q->RX1, 1);
+	case 0xFF17: /*Queue a read of RX1 pages from disk page RX0 into pages b onwards.*/
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_aio_submit(vm, MM, t, q->RX0, b, q->RX1, 0);
+	case 0xFF18: /*Queue a write of RX1 pages from pages b onwards to disk page RX0.*/
+		MM = sisa_dev_target(vm, q, &t);
+		return sisa_aio_submit(vm, MM, t, q->RX0, b, q->RX1, 1);
+	case 0xFF19: /*Tag of a finished transfer, or 0. A read's pages are only filled in now.*/
+		return sisa_aio_collect(vm, 0);
+	case 0xFF1A: /*The same, waiting for one if there are any queued.*/
+		return sisa_aio_collect(vm, 1);
+	}
+	return q->a;
+}
+/*
+	Put the driver's devices on a new VM's bus. 0x80 is left alone, it is reserved for system calls.
+	Returns 0 if out of memory.
+*/
+static int sisa_dev_attach(sisa_vm* vm){
+	return
+#ifdef USE_SDL2
+		sisa_irq_set(vm, 1, 8, sisa_dev_sdl, NULL) &&
+		sisa_irq_set(vm, 0xE020, 0xE022, sisa_dev_audio, NULL) &&
+		sisa_irq_set(vm, '\n', '\n', sisa_dev_screen, NULL) &&
+		sisa_irq_set(vm, '\r', '\r', sisa_dev_screen, NULL) &&
+#else
+		sisa_irq_set(vm, 1, 1, sisa_dev_console, NULL) &&
+		sisa_irq_set(vm, 0xa, 0xa, sisa_dev_console, NULL) &&
+		sisa_irq_set(vm, 0xd, 0xd, sisa_dev_console, NULL) &&
+#endif
+		sisa_irq_set(vm, 0xc, 0xc, sisa_dev_console, NULL) &&
+		sisa_irq_set(vm, 0xE000, 0xE005, sisa_dev_console, NULL) &&
+		sisa_irq_set(vm, 0xE010, 0xE012, sisa_dev_timer, NULL) &&
+		sisa_irq_set(vm, 0xFF10, 0xFF1A, sisa_dev_disk, NULL) &&
+		sisa_irq_set(vm, 0xffFF, 0xffFF, sisa_dev_dump, NULL);
 }
@@ -1,4 +1,14 @@
 #define SISA_DEBUGGER
+/*
+	The debugger reads and writes guest memory directly, and steps one instruction at a time,
+	so it always uses flat memory and the plain dispatcher.
+*/
+#ifndef NO_SPARSE_MEMORY
+#define NO_SPARSE_MEMORY
+#endif
+#ifdef USE_JIT
+#undef USE_JIT
+#endif
 #include "d.h"
 #include "isa.h"
 /*
@@ -38,6 +48,7 @@ char debugger_setting_minimal = 0;
 char debugger_setting_repeat = 0; /*r*/
 char* debugger_saved_last = NULL;
 static u M2[(((UU)1)<<24)];
+static sisa_vm* vm = NULL;
 
 #define N "\r\n"
 void respond(int bruh){
@@ -187,7 +198,7 @@ static char* read_until_terminator_alloced_modified(FILE* f){
 #ifdef USE_TERMIOS
 	fcntl(STDIN_FILENO, F_SETFL, 0);
 #endif
-	setvbuf ( stdout, stdout_buf, _IONBF, sizeof(stdout_buf));
+	setvbuf ( stdout, NULL, _IONBF, 0);
 	while(1){
 		if(feof(f)){break;}
 		c = fgetc(f);
@@ -576,7 +587,7 @@ void debugger_hook(unsigned short *a,
 		line = read_until_terminator_alloced_modified(stdin);
 		if(!line){
 			puts("\r\n Failed Malloc.");
-			dcl();
+			dcl(vm);
 			exit(1);
 		}
 		if(line[0] == '\0' && debugger_setting_repeat && debugger_saved_last)
@@ -585,7 +596,7 @@ void debugger_hook(unsigned short *a,
 			if(!line)
 			{
 				puts("\r\n Failed Malloc.");
-				dcl();
+				dcl(vm);
 				exit(1);
 			}
 			if(!debugger_setting_minimal)
@@ -601,7 +612,7 @@ void debugger_hook(unsigned short *a,
 					line = str_repl_allocf(line, names[i], get_name_eval(i));
 							if(!line){
 								puts("\r\n Failed Malloc.");
-								dcl();
+								dcl(vm);
 								exit(1);
 							}
 				}
@@ -611,7 +622,7 @@ void debugger_hook(unsigned short *a,
 					line = str_repl_allocf(line, "@", name_buf_temp);
 					if(!line){
 						puts("\r\n Failed Malloc.");
-						dcl();
+						dcl(vm);
 						exit(1);
 					}
 				}
@@ -717,7 +728,7 @@ void debugger_hook(unsigned short *a,
 				goto repl_start;
 			}
 			case 'q':
-			dcl();
+			dcl(vm);
 			{
 				char* tmp =strcatalloc(filename, ".dbg");
 				savenames(tmp);
@@ -1494,7 +1505,7 @@ void debugger_hook(unsigned short *a,
 				*a = 0;
 				*b = 0;
 				*c = 0;
-				R=0;
+				vm->R=0;
 				*program_counter_region = 0;
 				*program_counter = 0;
 				*RX0 = 0;
@@ -1840,62 +1851,67 @@ int main(int rc,char**rv){
 		exit(1);
 	}
 	filename = rv[1];
-		for(i=0;i<0x1000000 && !feof(F);){M_SAVER[0][i++]=fgetc(F);}
-		memcpy(M2, M_SAVER[0], 0x1000000);
+	vm = sisa_vm_new(0);
+	if(!vm){
+		puts("SISA16 debugger cannot allocate the virtual machine.");
+		exit(1);
+	}
+		for(i=0;i<0x1000000 && !feof(F);){vm->M_SAVER[0][i++]=fgetc(F);}
+		memcpy(M2, vm->M_SAVER[0], 0x1000000);
 	fclose(F);
-	R=0;
+	vm->R=0;
 
 	/*
 	*/
-	e();
+	e(vm);
 	puts("\r\nExecution Finished normally.\r\n");
-	if(R==0)puts("\r\nNo Errors Encountered.\r\n");
+	if(vm->R==0)puts("\r\nNo Errors Encountered.\r\n");
 	for(i=0;i<(1<<24)-31&&rc>2;i+=32)	
 		for(j=i,printf("%s\n%04lx|",(i&255)?"":"\n~",(unsigned long)i);j<i+32;j++)
-			printf("%02x%c",M_SAVER[0][j],((j+1)%8)?' ':'|');
-	if(R==1)puts("\n<Errfl, 16 bit div by 0>\n");
-	if(R==2)puts("\n<Errfl, 16 bit mod by 0>\n");
-	if(R==3)puts("\n<Errfl, 32 bit div by 0>\n");
-	if(R==4)puts("\n<Errfl, 32 bit mod by 0>\n");
-	if(R==5)puts("\n<Errfl, Bad Segment Page>\n");
-	if(R==6){
+			printf("%02x%c",vm->M_SAVER[0][j],((j+1)%8)?' ':'|');
+	if(vm->R==1)puts("\n<Errfl, 16 bit div by 0>\n");
+	if(vm->R==2)puts("\n<Errfl, 16 bit mod by 0>\n");
+	if(vm->R==3)puts("\n<Errfl, 32 bit div by 0>\n");
+	if(vm->R==4)puts("\n<Errfl, 32 bit mod by 0>\n");
+	if(vm->R==5)puts("\n<Errfl, Bad Segment Page>\n");
+	if(vm->R==6){
 		/*puts("\n<Errfl, Segment Cannot be Zero Pages>\n");*/
 		puts("\r\n<Errfl, deprecated error>\r\n");
 	}
-	if(R==7)puts("\n<Errfl, Segment Failed Allocation>\n");
+	if(vm->R==7)puts("\n<Errfl, Segment Failed Allocation>\n");
 #if defined(NO_FP)
-	if(R==13)
+	if(vm->R==13)
 		{puts("\n<Errfl, Either signed division or the FPU were disabled during compilation.>\n");
-		R=0;}
-	if(R==8)puts("\n<Errfl, Floating point unit disabled by compiletime options>\n");
+		vm->R=0;}
+	if(vm->R==8)puts("\n<Errfl, Floating point unit disabled by compiletime options>\n");
 #else
-	if(R==8)puts("\n<Errfl, Internal error, reporting broken SISA16 FPU. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
+	if(vm->R==8)puts("\n<Errfl, Internal error, reporting broken SISA16 FPU. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
 #endif
 
-	if(R==9)puts("\n<Errfl, Floating point divide by zero>\n");
+	if(vm->R==9)puts("\n<Errfl, Floating point divide by zero>\n");
 #if defined(NO_SIGNED_DIV)
-	if(R==13)
+	if(vm->R==13)
 		{puts("\n<Errfl, Either signed division or the FPU were disabled during compilation.>\n");
-		R=0;}
-	if(R==10)puts("\n<Errfl, Signed 32 bit division disabled by compiletime options>\n");
+		vm->R=0;}
+	if(vm->R==10)puts("\n<Errfl, Signed 32 bit division disabled by compiletime options>\n");
 #else
-	if(R==10)puts("\n<Errfl, Internal error, reporting broken SISA16 signed integer division module. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
+	if(vm->R==10)puts("\n<Errfl, Internal error, reporting broken SISA16 signed integer division module. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
 #endif
-	if(R==11)puts("\n<Errfl, Sandboxing limit reached >\n");
-	if(R==12)puts("\n<Errfl, Sandboxing could not allocate needed memory.>\n");
-	if(R==13)
+	if(vm->R==11)puts("\n<Errfl, Sandboxing limit reached >\n");
+	if(vm->R==12)puts("\n<Errfl, Sandboxing could not allocate needed memory.>\n");
+	if(vm->R==13)
 		{
 			puts("\n<Errfl, Internal error, Broken Float-Int Interop. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
-			R=0;
+			vm->R=0;
 		}
-	if(R==14){
+	if(vm->R==14){
 #if defined(NO_SEGMENT)
 		puts("\n<Errfl, Segment Disabled>");
 #else
 		puts("\n<Errfl, Internal error, Reporting segment disabled but not set that way at compiletime. Report this bug! https://github.com/gek169/Simple_ISA/   >");
 #endif
 	}
-	if(R==15 || R==16 || R==17 || R==18 || R==19){
+	if(vm->R==15 || vm->R==16 || vm->R==17 || vm->R==18 || vm->R==19){
 		puts("\n<Errfl, Privileged opcode executed underprivileged.>");
 	}
 	return 0;
@@ -1,4 +1,6 @@
-static char* insns[220] = {
+#ifndef SISA_INSTRUCTIONS_H
+#define SISA_INSTRUCTIONS_H
+static char* insns[222] = {
 	"halt", /*0*/
 	"lda",
 	"la",
@@ -240,9 +242,19 @@ static char* insns[220] = {
 	"user_farista",
 	"task_ric",
 	"user_farpagel",
-	"user_farpagest"
+	"user_farpagest",
+	"task_par",
+	"task_max"
 };
-static unsigned char insns_numargs[220] = {
+static const unsigned int n_insns = 222;
+#endif
+/*
+	The argument counts and the assembler's expansions, for the assembler, debugger and disassembler.
+	profile.h only wants the names and asks for just those with SISA_INSNS_NAMES_ONLY.
+*/
+#if !defined(SISA_INSNS_NAMES_ONLY) && !defined(SISA_INSTRUCTIONS_ARGS_H)
+#define SISA_INSTRUCTIONS_ARGS_H
+static unsigned char insns_numargs[222] = {
 	0,/*halt*/
 	2,1,2,1, /*load and load constant comboes, lda, la, ldb, lb*/
 	2, /*load constant into C*/
@@ -366,9 +378,13 @@ static unsigned char insns_numargs[220] = {
 		0,
 		/*user_farpagel and st*/
 		0,
+		0,
+		/*task_par*/
+		0,
+		/*task_max*/
 		0
 };
-static char* insn_repl[220] = {
+static char* insn_repl[222] = {
 	"bytes0;", 
 	/*The direct load-and-store operations have args.*/
 	"bytes1,",
@@ -619,6 +635,10 @@ static char* insn_repl[220] = {
 		/*task_ric*/
 		"bytes217;",
 		"bytes218;",
-		"bytes219;"
+		"bytes219;",
+		/*task_par*/
+		"bytes220;",
+		/*task_max*/
+		"bytes221;"
 };
-static const unsigned int n_insns = 220;
+#endif
@@ -8,6 +8,14 @@ static FILE* F;
 int main(int rc,char**rv){
 	UU i , j=~(UU)0;
 	SUU q_test = (SUU)-1;
+	sisa_vm* vm;
+	const char* profile_file = NULL;
+	UU ntasks = 0; /*-tasks, 0 for SISA_MAX_TASKS*/
+	const char* disk_name = NULL;
+	const char* disk_base = NULL;
+	const char* frames_name = NULL;
+	int headless = 0;
+	int dump = 0;
 	/*M = malloc((((UU)1)<<24));*/
 	
 	if(
@@ -246,61 +254,112 @@ int main(int rc,char**rv){
 			puts("The C compiler does not expose itself to be one of the ones recognized by this program. Please tell me on Github what you used.");
 			return 0;
 	}
+	/*
+		-profile takes the file to write the profile to, -tasks the number of user tasks,
+		-disk the disk image and -base a read-only image for it to overlay. -headless runs the SDL2 screen without
+		a window, and -frames writes what it shows to a file. Anything else asks for a memory dump.
+	*/
+	for(i = 2; i < (UU)rc; i++){
+		if(!strcmp(rv[i], "-profile") && i+1 < (UU)rc) profile_file = rv[++i];
+		else if(!strcmp(rv[i], "-tasks") && i+1 < (UU)rc) ntasks = strtoul(rv[++i], NULL, 0);
+		else if(!strcmp(rv[i], "-disk") && i+1 < (UU)rc) disk_name = rv[++i];
+		else if(!strcmp(rv[i], "-base") && i+1 < (UU)rc) disk_base = rv[++i];
+		else if(!strcmp(rv[i], "-headless")) headless = 1;
+		else if(!strcmp(rv[i], "-frames") && i+1 < (UU)rc) frames_name = rv[++i];
+		else dump = 1;
+	}
 	F=fopen(rv[1],"rb");
 	if(!F){
 		puts("SISA16 emulator cannot open this file.");
 		exit(1);
 	}
-		for(i=0;i<0x1000000 && !feof(F);){M_SAVER[0][i++]=fgetc(F);}
+	vm = sisa_vm_new(ntasks);
+	if(!vm){
+		puts("SISA16 emulator cannot allocate the virtual machine.");
+		exit(1);
+	}
+	if(disk_name) vm->dev->disk_name = disk_name;
+	vm->dev->disk_base = disk_base;
+	if(headless || frames_name){
+#ifdef USE_SDL2
+		vm->dev->headless = 1;
+		vm->dev->frames_name = frames_name;
+#else
+		puts("SISA16 emulator was built without SDL2, so there is no screen for -headless or -frames.");
+#endif
+	}
+		for(i=0;i<0x1000000 && !feof(F);){
+			u* p = sisa_mem_wp(vm->M_SAVER[0], i++);
+			if(!p){
+				puts("SISA16 emulator cannot allocate memory for the program.");
+				exit(1);
+			}
+			*p=fgetc(F);
+		}
 	fclose(F);
-	R=0;e();
-	for(i=0;i<(1<<24)-31&&rc>2;i+=32)	
+	if(profile_file){
+#ifdef USE_PROFILE
+		vm->prof = sisa_prof_new();
+		if(!vm->prof){
+			puts("SISA16 emulator cannot allocate the profiler.");
+			exit(1);
+		}
+#else
+		puts("SISA16 emulator was built without the profiler, rebuild with -DUSE_PROFILE to use -profile.");
+#endif
+	}
+	vm->R=0;e(vm);
+#ifdef USE_PROFILE
+	if(vm->prof) sisa_prof_report(vm->prof, profile_file);
+#endif
+	for(i=0;i<(1<<24)-31&&dump;i+=32)	
 		for(j=i,printf("%s\n%06lx|",(i&255)?"":"\n~",(unsigned long)i);j<i+32;j++)
-			printf("%02x%c",M_SAVER[0][j],((j+1)%8)?' ':'|');
-	if(R==1)puts("\n<Errfl, 16 bit div by 0>\n");
-	if(R==2)puts("\n<Errfl, 16 bit mod by 0>\n");
-	if(R==3)puts("\n<Errfl, 32 bit div by 0>\n");
-	if(R==4)puts("\n<Errfl, 32 bit mod by 0>\n");
-	if(R==5)puts("\n<Errfl, Bad Segment Page>\n");
-	if(R==6){
+			printf("%02x%c",MEM_READ(vm->M_SAVER[0], j),((j+1)%8)?' ':'|');
+	if(vm->R==1)puts("\n<Errfl, 16 bit div by 0>\n");
+	if(vm->R==2)puts("\n<Errfl, 16 bit mod by 0>\n");
+	if(vm->R==3)puts("\n<Errfl, 32 bit div by 0>\n");
+	if(vm->R==4)puts("\n<Errfl, 32 bit mod by 0>\n");
+	if(vm->R==5)puts("\n<Errfl, Bad Segment Page>\n");
+	if(vm->R==6){
 		/*puts("\n<Errfl, Segment Cannot be Zero Pages>\n");*/
 		puts("\r\n<Errfl, deprecated error>\r\n");
 	}
-	if(R==7)puts("\n<Errfl, Segment Failed Allocation>\n");
+	if(vm->R==7)puts("\n<Errfl, Segment Failed Allocation>\n");
 #if defined(NO_FP)
-	if(R==13)
+	if(vm->R==13)
 		{puts("\n<Errfl, Either signed division or the FPU were disabled during compilation.>\n");
-		R=0;}
-	if(R==8)puts("\n<Errfl, Floating point unit disabled by compiletime options>\n");
+		vm->R=0;}
+	if(vm->R==8)puts("\n<Errfl, Floating point unit disabled by compiletime options>\n");
 #else
-	if(R==8)puts("\n<Errfl, Internal error, reporting broken SISA16 FPU. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
+	if(vm->R==8)puts("\n<Errfl, Internal error, reporting broken SISA16 FPU. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
 #endif
 
-	if(R==9)puts("\n<Errfl, Floating point divide by zero>\n");
+	if(vm->R==9)puts("\n<Errfl, Floating point divide by zero>\n");
 #if defined(NO_SIGNED_DIV)
-	if(R==13)
+	if(vm->R==13)
 		{puts("\n<Errfl, Either signed division or the FPU were disabled during compilation.>\n");
-		R=0;}
-	if(R==10)puts("\n<Errfl, Signed 32 bit division disabled by compiletime options>\n");
+		vm->R=0;}
+	if(vm->R==10)puts("\n<Errfl, Signed 32 bit division disabled by compiletime options>\n");
 #else
-	if(R==10)puts("\n<Errfl, Internal error, reporting broken SISA16 signed integer division module. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
+	if(vm->R==10)puts("\n<Errfl, Internal error, reporting broken SISA16 signed integer division module. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
 #endif
-	if(R==11)puts("\n<Errfl, Sandboxing limit reached >\n");
-	if(R==12)puts("\n<Errfl, Sandboxing could not allocate needed memory.>\n");
-	if(R==13)
+	if(vm->R==11)puts("\n<Errfl, Sandboxing limit reached >\n");
+	if(vm->R==12)puts("\n<Errfl, Sandboxing could not allocate needed memory.>\n");
+	if(vm->R==13)
 		{
 			puts("\n<Errfl, Internal error, Broken Float-Int Interop. Report this bug! https://github.com/gek169/Simple_ISA/  >\n");
-			R=0;
+			vm->R=0;
 		}
-	if(R==14){
+	if(vm->R==14){
 #if defined(NO_SEGMENT)
 		puts("\n<Errfl, Segment Disabled>");
 #else
 		puts("\n<Errfl, Internal error, Reporting segment disabled but not set that way at compiletime. Report this bug! https://github.com/gek169/Simple_ISA/   >");
 #endif
 	}
-	if(R==15 || R==16 || R==17 || R==18 || R==19){
+	if(vm->R==15 || vm->R==16 || vm->R==17 || vm->R==18 || vm->R==19){
 		puts("\n<Errfl, Privileged opcode executed underprivileged.>");
 	}
+	sisa_vm_free(vm);
 	return 0;
 }
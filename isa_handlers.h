@@ -0,0 +1,791 @@
+/*
+	The instruction handlers, the body of e().
+	Included once per privilege level, see SISA_SPLIT_LOOPS in isa.h.
+*/
+
+/*Free slots!*/
+
+L(G_NOP):D
+#ifndef NO_BUDGET
+/*Out of budget. Without one, it just starts counting again, after looking at the timer's deadline.*/
+L(G_YIELD):
+	budget = 0; /*BUDGET() took it past 0, for the instruction which has not run yet*/
+	SISA_RETIRE()
+	if(!max_insns){
+		int due = !solo && sisa_timer_due(vm);
+		budget = budget_mark = (!solo && vm->timer_at) ? SISA_TIMER_CHECK : ~(UU)0;
+		if(due && EMULATE_DEPTH){SISA_R=0xFF; goto L(G_HALT);} /*as if its slice had run out*/
+		goto L(G_NOP);
+	}
+	SAVE_LIVE(a); SAVE_LIVE(b); SAVE_LIVE(c);
+	SAVE_LIVE(program_counter); SAVE_LIVE(stack_pointer); SAVE_LIVE(program_counter_region);
+	SAVE_LIVE(RX0); SAVE_LIVE(RX1); SAVE_LIVE(RX2); SAVE_LIVE(RX3);
+#ifndef NO_PREEMPT
+	SAVE_LIVE(instruction_counter);
+#endif
+	vm->live_task = current_task;
+	vm->live_depth = EMULATE_DEPTH;
+	vm->live_saved = 1;
+	return SISA_RUN_BUDGET;
+#endif
+#ifdef USE_JIT
+L(G_JIT):
+{
+	const void* jc = max_insns ? NULL : sisa_jit_find(vm, EMULATE_DEPTH?current_task:0, GET_EFF_PC(), JIT_LIMIT);
+	if(jc){
+		sisa_jit_state* js = &vm->jit->st;
+		js->a = a; js->b = b; js->c = c; js->stack_pointer = stack_pointer;
+		js->RX0 = RX0; js->RX1 = RX1; js->RX2 = RX2; js->RX3 = RX3;
+		js->M = M;
+		JIT_IC_OUT
+		vm->jit->enter(js, jc);
+		a = js->a; b = js->b; c = js->c; stack_pointer = js->stack_pointer;
+		RX0 = js->RX0; RX1 = js->RX1; RX2 = js->RX2; RX3 = js->RX3;
+		SET_PCR(js->pc >> 16);
+		SET_PC(js->pc);
+		JIT_IC_IN
+		if(js->smc){js->smc = 0; vm->jit_dirty = 1;}
+	}
+}
+/*The instructions run there were already counted.*/
+goto *L(goto_table)[CONSUME_BYTE];
+#endif
+L(G_AND):a&=b;D
+L(G_OR):a|=b;D
+L(G_XOR):a^=b;D
+L(G_GETCHAR):{
+	STASH_REGS;
+#ifndef NO_DEVICE_PRIVILEGE
+	if(EMULATE_DEPTH){SISA_R = 16; goto L(G_HALT);}
+#endif
+	a_stash=gch(vm);
+	UNSTASH_REGS;
+}D
+L(G_PUTCHAR):{
+	STASH_REGS;
+#ifndef NO_DEVICE_PRIVILEGE
+	if(EMULATE_DEPTH){SISA_R = 17; goto L(G_HALT);}
+#endif
+	pch(vm, a_stash);
+	UNSTASH_REGS;
+}D
+L(G_LSHIFT):a<<=b;D
+L(G_RSHIFT):a>>=b;D
+L(G_ILDA):a=MEM_READ(M, c)D
+L(G_ILDB):b=MEM_READ(M, c)D
+L(G_CAB):c=(a<<8)|(b&255)D
+L(G_AB):a=b;D
+L(G_BA):b=a;D
+L(G_ALC):a=c&0xff;D
+L(G_AHC):a=(c>>8);D
+L(G_CBA):c=(b<<8)|(a&0xff)D
+L(G_LLA):a=CONSUME_TWO_BYTES;D
+L(G_ILLDA):a=Z_READ_TWO_BYTES_THROUGH_C;D
+L(G_LLB):b=CONSUME_TWO_BYTES;D
+L(G_ILLDB):b=Z_READ_TWO_BYTES_THROUGH_C;D
+L(G_ILLDAA):a=Z_READ_TWO_BYTES_THROUGH_A;D
+L(G_ILLDBB):b=Z_READ_TWO_BYTES_THROUGH_B;D
+L(G_ILLDAB):a=Z_READ_TWO_BYTES_THROUGH_B;D
+L(G_ILLDBA):b=Z_READ_TWO_BYTES_THROUGH_A;D
+L(G_CA):c=a;D
+L(G_CB):c=b;D
+L(G_AC):a=c;D
+L(G_BC):b=c;D
+L(G_ISTA):write_byte(a,c)D
+L(G_ISTB):write_byte(b,c)D
+L(G_ISTLA):write_2bytes(a,c)D
+L(G_ISTLB):write_2bytes(b,c)D
+L(G_JMP):program_counter=c;JD
+L(G_STLA):write_2bytes(a,CONSUME_TWO_BYTES)D
+L(G_STLB):write_2bytes(b,CONSUME_TWO_BYTES)D
+L(G_STC):write_2bytes(c,CONSUME_TWO_BYTES)D
+L(G_PUSH):stack_pointer+=CONSUME_TWO_BYTES;D
+L(G_POP):stack_pointer-=CONSUME_TWO_BYTES;D
+L(G_PUSHA):stack_pointer+=a;D
+L(G_POPA):stack_pointer-=a;D
+L(G_ASTP):a=stack_pointer;D
+L(G_BSTP):b=stack_pointer;D
+L(G_COMPL):a=~a;D
+L(G_CPC):c=GET_PC();D
+L(G_LDA):a=MEM_READ(M, CONSUME_TWO_BYTES)D
+L(G_LA):a=CONSUME_BYTE;D
+L(G_LDB):b=MEM_READ(M, CONSUME_TWO_BYTES)D
+L(G_LB):b=CONSUME_BYTE;D
+L(G_SC):c=CONSUME_TWO_BYTES;D
+L(G_STA):write_byte(a,CONSUME_TWO_BYTES)D
+L(G_STB):write_byte(b,CONSUME_TWO_BYTES)D
+L(G_JMPIFEQ):if(a==1)SET_PC(c);JD/*Would require edit if you wanted a 32 bit PC*/
+L(G_JMPIFNEQ):if(a!=1)SET_PC(c);JD/*Would require edit if you wanted a 32 bit PC*/
+L(G_ADD):a+=b;D
+L(G_SUB):a-=b;D
+L(G_MUL):a*=b;D
+L(G_DIV):{if(b!=0)a/=b;else{SISA_R=1;goto L(G_HALT);}}D
+L(G_MOD):{if(b!=0)a%=b;else{SISA_R=2;goto L(G_HALT);}}D
+L(G_CMP):
+
+if(a<b)a=0;
+else if(a>b) a=2;
+else a=1;
+/*a = ((a>b)*2) + (a==b)*1;*/
+
+D
+L(G_FARILLDA):a=Z_FAR_MEMORY_READ_C_HIGH8_B_LOW16;D
+L(G_FARISTLA):write_2bytes(a,((((UU)c&255)<<16)|((UU)b)))D
+L(G_FARILLDB):b=Z_FAR_MEMORY_READ_C_HIGH8_A_LOW16;D
+L(G_FARISTLB):write_2bytes(b,((((UU)c&255)<<16)|((UU)a)))D
+L(G_FARPAGEL):
+{
+	STASH_REGS;
+	PROFILE_EVENT(SISA_PROF_FARPAGEL)
+	{
+		u* wp = sisa_mem_wp(M_STASH, ((UU)a_stash)<<8);
+		if(!wp){SISA_R=12; goto L(G_HALT);}
+		memmove(wp,sisa_mem_rp(M_STASH, ((UU)c_stash)<<8),256);
+		sisa_code_dirty(vm, EMULATE_DEPTH * current_task, ((UU)a_stash)<<8, 256);
+	}
+	UNSTASH_REGS;
+#ifndef NO_PREEMPT
+	if(EMULATE_DEPTH) instruction_counter += HIGH_INSN_COST; /*This is a very expensive instruction.*/
+#endif
+}
+D
+L(G_FARPAGEST):{
+	STASH_REGS;
+	PROFILE_EVENT(SISA_PROF_FARPAGEST)
+	{
+		u* wp = sisa_mem_wp(M_STASH, ((UU)c_stash)<<8);
+		if(!wp){SISA_R=12; goto L(G_HALT);}
+		memmove(wp,sisa_mem_rp(M_STASH, ((UU)a_stash)<<8),256);
+		sisa_code_dirty(vm, EMULATE_DEPTH * current_task, ((UU)c_stash)<<8, 256);
+	}
+	UNSTASH_REGS;
+#ifndef NO_PREEMPT
+	if(EMULATE_DEPTH) instruction_counter += HIGH_INSN_COST; /*This is a very expensive instruction.*/
+#endif
+}D
+L(G_LFARPC):
+SET_PCR(a);
+SET_PC(0);
+JD/*Would require edit if you wanted a 32 bit PC*/
+L(G_CALL):
+write_2bytes(GET_PC(),stack_pointer);stack_pointer+=2;/*Would require edit if you wanted a 32 bit PC*/
+SET_PC(c);JD/*Would require edit if you wanted a 32 bit PC*/
+L(G_RET):SET_PC(Z_POP_TWO_BYTES_FROM_STACK);JD/*Would require edit if you wanted a 32 bit PC*/
+L(G_FARCALL):
+	PROFILE_EDGE(SISA_PROF_CALL, GET_EFF_PC_MINUS(1), (((UU)a&255)<<16) | (UU)c)
+	write_2bytes(GET_PC(),stack_pointer);stack_pointer+=2;/*Would require edit if you wanted a 32 bit PC*/
+	write_byte(GET_PCR(),stack_pointer);stack_pointer+=1;/*Would require edit if you wanted a 32 bit PC*/
+	SET_PCR(a);/*Would require edit if you wanted a 32 bit PC*/
+	SET_PC(c);/*Would require edit if you wanted a 32 bit PC*/
+JD
+L(G_FARRET):
+	PROFILE_EDGE(SISA_PROF_RET, GET_EFF_PC_MINUS(1),
+		((UU)MEM_READ(M, (U)(stack_pointer-1))<<16) | sisa_mem_rd2(M, (U)(stack_pointer-3)))
+	stack_pointer-=1;
+	SET_PCR(MEM_READ(M, stack_pointer));
+	SET_PC(Z_POP_TWO_BYTES_FROM_STACK);
+JD
+L(G_FARILDA):a=MEM_READ(M, (((UU)c&255)<<16) |  ((UU)b))D
+L(G_FARISTA):write_byte(a,((((UU)c&255)<<16)|((UU)b)))D
+L(G_FARILDB):b=MEM_READ(M, (((UU)c&255)<<16)|((UU)a))D
+L(G_FARISTB):write_byte(b,((((UU)c&255)<<16)|((UU)a)))D
+
+L(TB): /**/
+{
+		if(EMULATE_DEPTH > 0) {SISA_R=15; goto L(G_HALT);}
+		if(vm->task_done[current_task]){ /*task_par already ran it, hand over how it ended.*/
+			vm->task_done[current_task] = 0;
+			a = vm->task_code[current_task];
+			goto L(G_NOP);
+		}
+		SAVE_REGISTER(a, 0);
+		SAVE_REGISTER(b, 0);
+		SAVE_REGISTER(c, 0);
+		SAVE_REGISTER(program_counter, 0);
+		SAVE_REGISTER(stack_pointer, 0);
+		SAVE_REGISTER(program_counter_region, 0);
+		SAVE_REGISTER(RX0, 0);
+		SAVE_REGISTER(RX1, 0);
+		SAVE_REGISTER(RX2, 0);
+		SAVE_REGISTER(RX3, 0);
+		SET_DEPTH(1) M=vm->M_SAVER[current_task];
+#ifdef USE_JIT
+		JM = vm->JMAP[current_task];
+#endif
+		/*Load on up again! We're continuing where we left off!*/
+		LOAD_REGISTER(a, current_task);
+		LOAD_REGISTER(b, current_task);
+		LOAD_REGISTER(c, current_task);
+		LOAD_REGISTER(program_counter, current_task);
+		LOAD_REGISTER(program_counter_region, current_task);
+		LOAD_REGISTER(stack_pointer, current_task);
+		LOAD_REGISTER(RX0, current_task);
+		LOAD_REGISTER(RX1, current_task);
+		LOAD_REGISTER(RX2, current_task);
+		LOAD_REGISTER(RX3, current_task);
+#ifndef NO_PREEMPT
+		LOAD_REGISTER(instruction_counter, current_task);
+#endif
+}TO_USER
+
+L(TC):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=vm->REG_SAVER[current_task].a;D
+L(TD):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=vm->REG_SAVER[current_task].b;D
+L(TE):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=vm->REG_SAVER[current_task].c;D
+L(TF):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}RX0=vm->REG_SAVER[current_task].RX0;D
+L(U0):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}RX0=vm->REG_SAVER[current_task].RX1;D
+L(U1):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}RX0=vm->REG_SAVER[current_task].RX2;D
+L(U2):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}RX0=vm->REG_SAVER[current_task].RX3;D
+L(U3):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=vm->REG_SAVER[current_task].stack_pointer;D
+L(U4):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=vm->REG_SAVER[current_task].program_counter;D
+L(U5):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=vm->REG_SAVER[current_task].program_counter_region;D
+L(U6):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}a=MEM_READ(vm->M_SAVER[current_task], (((UU)c&255)<<16) | (UU)b)D
+L(U7):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}vm->REG_SAVER[current_task].a=a;D
+L(G_TASK_SET): /*task_set*/
+	if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	current_task = a%vm->ntasks + 1;
+	if(!vm->M_SAVER[current_task]){
+		STASH_REGS;
+		if(!sisa_task_new(vm, current_task)){SISA_R=12; goto L(G_HALT);}
+		UNSTASH_REGS;
+	}
+D
+L(U9):
+	if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	vm->REG_SAVER[current_task].program_counter_region = 0;
+	vm->REG_SAVER[current_task].program_counter = 0;
+#ifndef NO_PREEMPT
+	vm->REG_SAVER[current_task].instruction_counter = 0; /*So that if we drop back in, the IC doesnt immediately kick in.*/
+#endif
+	vm->task_done[current_task] = 0; /*Whatever task_par left it holding is gone with it.*/
+D
+L(UA):SISA_R=19;goto L(G_HALT);
+L(G_ALPUSH):	write_2bytes(a,stack_pointer);	stack_pointer+=2;D
+L(G_BLPUSH):	write_2bytes(b,stack_pointer);	stack_pointer+=2;D
+L(G_CPUSH):	write_2bytes(c,stack_pointer);	stack_pointer+=2;D
+L(G_APUSH):	write_byte(a,stack_pointer);	stack_pointer+=1;D
+L(G_BPUSH):	write_byte(b,stack_pointer);	stack_pointer+=1;D
+L(G_ALPOP):a=Z_POP_TWO_BYTES_FROM_STACK;D
+L(G_BLPOP):b=Z_POP_TWO_BYTES_FROM_STACK;D
+L(G_CPOP):c=Z_POP_TWO_BYTES_FROM_STACK;D
+L(G_APOP):stack_pointer-=1;a=MEM_READ(M, stack_pointer)D
+L(G_BPOP):stack_pointer-=1;b=MEM_READ(M, stack_pointer)D
+/*Would require edit if you wanted a 32 bit PC*/
+L(G_INTERRUPT):
+{
+	STASH_REGS;
+	PROFILE_EVENT(SISA_PROF_INTERRUPT)
+#ifndef NO_DEVICE_PRIVILEGE
+	if(EMULATE_DEPTH){SISA_R = 18; goto L(G_HALT);}
+#endif
+	{
+		sisa_irq q;
+		q.a = a_stash;
+		q.b = b_stash;
+		q.c = c_stash;
+		q.stack_pointer = stack_pointer_stash;
+		q.program_counter = program_counter_stash;
+		q.program_counter_region = program_counter_region_stash;
+		q.RX0 = RX0_stash;
+		q.RX1 = RX1_stash;
+		q.RX2 = RX2_stash;
+		q.RX3 = RX3_stash;
+		q.M = M_STASH;
+		q.t = EMULATE_DEPTH ? current_task : 0;
+		SISA_RETIRE()
+		a_stash = sisa_irq_dispatch(vm, &q);
+		SISA_TIMER_ARM()
+	}
+	UNSTASH_REGS;
+}
+D
+L(G_CLOCK):{
+	size_t q;
+	PROFILE_EVENT(SISA_PROF_CLOCK)
+	{
+		STASH_REGS;
+		q=clock();
+		UNSTASH_REGS;
+	}
+	a=((q)/(CLOCKS_PER_SEC/1000));
+	b=q/(CLOCKS_PER_SEC);
+	c=q;
+#ifndef NO_PREEMPT
+	if(EMULATE_DEPTH) instruction_counter += EXTREME_HIGH_INSN_COST; /*This is a very VERY expensive instruction.*/
+#endif
+}D
+/*load from RX0*/
+L(G_ARX0):a=RX0;D
+L(G_BRX0):b=RX0;D
+L(V9):c=RX0;D
+/*store to RX0*/
+L(VA):RX0=a;D
+L(VB):RX0=b;D
+L(VC):RX0=c;D
+/*load from RX1*/
+L(VD):a=RX1;D
+L(VE):b=RX1;D
+L(VF):c=RX1;D
+/*Store*/
+L(W0):RX1=a;D
+L(W1):RX1=b;D
+L(W2):RX1=c;D
+/*load from RX2*/
+L(W3):a=RX2;D
+L(W4):b=RX2;D
+L(W5):c=RX2;D
+/*store to RX2*/
+L(W6):RX2=a;D
+L(W7):RX2=b;D
+L(W8):RX2=c;D
+/*load from RX3*/
+L(W9):a=RX3;D
+L(WA):b=RX3;D
+L(WB):c=RX3;D
+/*store to RX3*/
+L(WC):RX3=a;D
+L(WD):RX3=b;D
+L(WE):RX3=c;D
+/*Register-to-register moves for RX registers.*/
+L(WF):RX0=RX1;D
+L(X0):RX0=RX2;D
+L(X1):RX0=RX3;D
+
+L(X2):RX1=RX0;D
+L(X3):RX1=RX2;D
+L(X4):RX1=RX3;D
+
+L(X5):RX2=RX0;D
+L(X6):RX2=RX1;D
+L(X7):RX2=RX3;D
+
+L(X8):RX3=RX0;D
+L(X9):RX3=RX1;D
+L(XA):RX3=RX2;D
+
+/*loads*/
+L(XB):RX0=CONSUME_FOUR_BYTES;D
+L(XC):RX1=CONSUME_FOUR_BYTES;D
+L(XD):RX2=CONSUME_FOUR_BYTES;D
+L(XE):RX3=CONSUME_FOUR_BYTES;D
+/*far indirect loads, through C and A.*/
+L(XF):RX0=Z_FAR_MEMORY_READ_C_HIGH8_A_LOW16_4;D
+L(Y0):RX1=Z_FAR_MEMORY_READ_C_HIGH8_A_LOW16_4;D
+L(Y1):RX2=Z_FAR_MEMORY_READ_C_HIGH8_A_LOW16_4;D
+L(Y2):RX3=Z_FAR_MEMORY_READ_C_HIGH8_A_LOW16_4;D
+/*far indirect stores, through C and A*/
+L(Y3):write_4bytes(RX0,((((UU)c)<<16)|((UU)a)))D
+L(Y4):write_4bytes(RX1,((((UU)c)<<16)|((UU)a)))D
+L(Y5):write_4bytes(RX2,((((UU)c)<<16)|((UU)a)))D
+L(Y6):write_4bytes(RX3,((((UU)c)<<16)|((UU)a)))D
+/*math*/
+L(Y7):RX0=(RX0+RX1)&0xffFFffFF;D
+L(Y8):RX0=(RX0-RX1)&0xffFFffFF;D
+L(Y9):RX0=(RX0*RX1)&0xffFFffFF;D
+L(YA):if(RX1!=0)RX0=(RX0/RX1)&0xffFFffFF;else{SISA_R=3;goto L(G_HALT);}D
+L(YB):if(RX1!=0)RX0=(RX0%RX1)&0xffFFffFF;else{SISA_R=4;goto L(G_HALT);}D
+L(YC):RX0=(RX0>>(RX1))&0xffFFffFF;D
+L(YD):RX0=(RX0<<(RX1))&0xffFFffFF;D
+/*pushes*/
+L(YE):write_4bytes(RX0, stack_pointer);stack_pointer+=4;D
+L(YF):write_4bytes(RX1, stack_pointer);stack_pointer+=4;D
+L(Z0):write_4bytes(RX2, stack_pointer);stack_pointer+=4;D
+L(Z1):write_4bytes(RX3, stack_pointer);stack_pointer+=4;D
+/*pops*/
+L(Z2):RX0=Z_POP_FOUR_BYTES_FROM_STACK;D
+L(Z3):RX1=Z_POP_FOUR_BYTES_FROM_STACK;D
+L(Z4):RX2=Z_POP_FOUR_BYTES_FROM_STACK;D
+L(Z5):RX3=Z_POP_FOUR_BYTES_FROM_STACK;D
+/*bitwise*/
+L(Z6):RX0=RX0&RX1;D
+L(Z7):RX0=RX0|RX1;D
+L(Z8):RX0=RX0^RX1;D
+L(Z9):RX0=~RX0;D
+L(ZA):
+	if(RX0<RX1)a=0;
+	else if(RX0>RX1)a=2;
+	else a=1;
+D
+L(ZB):
+#if !defined(NO_SEGMENT)
+	if(RX1>=SEGMENT_PAGES){SISA_R=5;goto L(G_HALT);}
+	{
+		STASH_REGS;
+		PROFILE_EVENT(SISA_PROF_SEG_LD)
+		{
+			u* wp = sisa_mem_wp(M_STASH, 0x100 * (RX0&0xffFF));
+			if(!wp){SISA_R=12; goto L(G_HALT);}
+			memcpy(
+				wp,
+				sisa_mem_rp(vm->SEGS[EMULATE_DEPTH * current_task], 0x100 * RX1), 
+				0x100
+			);
+			sisa_code_dirty(vm, EMULATE_DEPTH * current_task, 0x100 * (RX0&0xffFF), 0x100);
+		}
+		UNSTASH_REGS;
+#ifndef NO_PREEMPT
+		if(EMULATE_DEPTH) instruction_counter += MED_INSN_COST; /*This is a very expensive instruction.*/
+#endif
+	}
+	D
+#else
+	SISA_R=14; goto L(G_HALT);
+#endif
+L(ZC):
+#if !defined(NO_SEGMENT)
+	if(RX1>=SEGMENT_PAGES){SISA_R=5;goto L(G_HALT);}
+	else
+	{
+		STASH_REGS;
+		PROFILE_EVENT(SISA_PROF_SEG_ST)
+		{
+			u* wp = sisa_mem_wp(vm->SEGS[EMULATE_DEPTH * current_task], 0x100 * RX1);
+			if(!wp){SISA_R=7; goto L(G_HALT);}
+			memcpy(wp, sisa_mem_rp(M_STASH, 0x100 * (RX0&0xffFF)), 0x100);
+		}
+		UNSTASH_REGS;
+#ifndef NO_PREEMPT
+		if(EMULATE_DEPTH) instruction_counter += MED_INSN_COST; /*This is a very expensive instruction.*/
+#endif
+	}
+	D
+#else
+	SISA_R=14; goto L(G_HALT);
+#endif
+
+
+L(ZD): goto L(G_NOP); /*FREE INSTRUCTION!!!*/
+
+#ifdef NO_FP
+/*no floating point unit.*/
+/*
+	TODO: implement software floating point unit.
+*/
+L(ZE): SISA_R=8; goto L(G_HALT);
+L(ZF): SISA_R=8; goto L(G_HALT);
+L(G_AA0): SISA_R=8; goto L(G_HALT);
+L(G_AA1): SISA_R=8; goto L(G_HALT);
+/*cmp*/
+L(G_FLTCMP): SISA_R=8; goto L(G_HALT);
+#else
+L(ZE):{
+	float fRX0, fRX1;
+	UU RX0_CP = RX0;
+	UU RX1_CP = RX1;
+	memcpy(&fRX0, &RX0_CP, 4);
+	memcpy(&fRX1, &RX1_CP, 4);
+	fRX0 = fRX0 + fRX1;
+	memcpy(&RX0_CP, &fRX0, 4);
+	RX0 = RX0_CP;
+}D
+L(ZF): {
+	float fRX0, fRX1;
+	UU RX0_CP = RX0;
+	UU RX1_CP = RX1;
+	memcpy(&fRX0, &RX0_CP, 4);
+	memcpy(&fRX1, &RX1_CP, 4);
+	fRX0 = fRX0 - fRX1;
+	memcpy(&RX0_CP, &fRX0, 4);
+	RX0 = RX0_CP;
+}D
+L(G_AA0):{
+		float fRX0, fRX1;
+	UU RX0_CP = RX0;
+	UU RX1_CP = RX1;
+	memcpy(&fRX0, &RX0_CP, 4);
+	memcpy(&fRX1, &RX1_CP, 4);
+	fRX0 = fRX0 * fRX1;
+	memcpy(&RX0_CP, &fRX0, 4);
+	RX0 = RX0_CP;
+}D
+L(G_AA1): {
+	float fRX0, fRX1;
+	UU RX0_CP = RX0;
+	UU RX1_CP = RX1;
+	memcpy(&fRX0, &RX0_CP, 4);
+	memcpy(&fRX1, &RX1_CP, 4);
+	if(fRX1 == 0.0 || 
+		fRX1 == -0.0){
+			SISA_R=9; goto L(G_HALT);
+		}
+	fRX0 = fRX0 / fRX1;
+	memcpy(&RX0_CP, &fRX0, 4);
+	RX0 = RX0_CP;
+}D
+/*cmp*/
+L(G_FLTCMP): {
+	float fRX0, fRX1;
+	UU RX0_CP = RX0;
+	UU RX1_CP = RX1;
+	memcpy(&fRX0, &RX0_CP, 4);
+	memcpy(&fRX1, &RX1_CP, 4);
+	if(
+		fRX0<fRX1
+	)a=0;else if(
+		fRX0>fRX1
+	)a=2;else a=1;
+}D
+#endif
+L(G_AA3):RX0=SEGMENT_PAGES;D
+L(G_AA4):RX0=sisa_mem_rd4(M, RX1&0xffFFff)D
+L(G_AA5):RX0=sisa_mem_rd4(M, RX0&0xffFFff)D
+L(G_AA6):SET_PCR(RX0>>16);SET_PC(RX0 & 0xffFF);JD
+L(G_AA7):write_4bytes(RX0,RX1)D
+L(G_AA8):write_4bytes(RX1,RX0)D
+L(G_AA9):c=(RX0>>16);b=RX0;D
+L(G_AA10):c=(RX0>>16);a=RX0;D
+#if !defined(NO_SIGNED_DIV)
+L(G_AA11):{SUU SRX0, SRX1;
+		SRX0 = RX0;
+		SRX1 = RX1;
+	if(SRX1!=0)RX0=(SRX0/SRX1)&0xffFFffFF;else{SISA_R=3;goto L(G_HALT);}
+}D
+L(G_AA12):{SUU SRX0, SRX1;
+		SRX0 = RX0;
+		SRX1 = RX1;
+	if(SRX1!=0)RX0=(SRX0%SRX1)&0xffFFffFF;else{SISA_R=4;goto L(G_HALT);}
+}D
+#else
+	/*
+		TODO: Emulate signed integer division for two's complement guaranteed behavior.
+	*/
+	L(G_AA11):SISA_R=10;goto L(G_HALT);
+	L(G_AA12):SISA_R=10;goto L(G_HALT);
+#endif
+	L(G_AA13):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		RX0=sisa_mem_rd4(M, flight);
+	}D
+	L(G_AA14):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		RX1=sisa_mem_rd4(M, flight);
+	}D
+	L(G_AA15):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		RX2=sisa_mem_rd4(M, flight);
+	}D
+	L(G_AA16):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		RX3=sisa_mem_rd4(M, flight);
+	}D
+	L(G_AA17):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		a=sisa_mem_rd2(M, flight);
+	}D
+	L(G_AA18):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		b=sisa_mem_rd2(M, flight);
+	}D
+	L(G_AA19):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		c=sisa_mem_rd2(M, flight);
+	}D
+	L(G_AA20):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		write_4bytes(RX0, flight);
+	}D
+	L(G_AA21):{UU flight;
+			flight = CONSUME_THREE_BYTES;
+			write_4bytes(RX1, flight);
+	}D
+	L(G_AA22):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		write_4bytes(RX2, flight);
+	}D
+	L(G_AA23):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		write_4bytes(RX3, flight);
+	}D
+	L(G_AA24):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		write_2bytes(a, flight);
+	}D
+	L(G_AA25):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		write_2bytes(b, flight);
+	}D
+	L(G_AA26):{UU flight;
+		flight = CONSUME_THREE_BYTES;
+		write_2bytes(c, flight);
+	}D
+	L(G_AINCR):a++;D
+	L(G_ADECR):a--;D
+	L(G_RX0INCR):RX0++;D
+	L(G_RX0DECR):RX0--;D
+#if defined(NO_FP)
+	L(G_ITOF):L(G_FTOI):SISA_R=8;goto L(G_HALT);
+#else
+	L(G_ITOF):{
+		float fRX0;
+		SUU lRX0 = RX0;
+		fRX0 = (float)lRX0;
+		memcpy(&lRX0, &fRX0, 4);
+		RX0 = lRX0;
+	}D
+	L(G_FTOI):{
+		float fRX0;
+		SUU lRX0 = RX0;
+			memcpy(&fRX0,&lRX0,4);
+			lRX0 = fRX0;
+			memcpy(&lRX0, &fRX0,4);
+		RX0 = lRX0;
+	}D
+#endif
+#if !defined(NO_EMULATE)
+	L(G_EMULATE):L(G_EMULATE_SEG):{
+		if(EMULATE_DEPTH) {SISA_R=11; goto L(G_HALT);}
+		PROFILE_EVENT(SISA_PROF_EMULATE)
+		vm->task_done[current_task] = 0; /*It is a new program.*/
+
+		{
+			STASH_REGS;
+#ifdef USE_SPARSE_MEMORY
+			sisa_mem_share(vm->M_SAVER[current_task], vm->M_SAVER[0], 0x100);
+#else
+			memcpy(vm->M_SAVER[current_task], vm->M_SAVER[0], 0x1000000);
+#endif
+			UNSTASH_REGS;
+		}
+		SAVE_REGISTER(a, 0);
+		SAVE_REGISTER(b, 0);
+		SAVE_REGISTER(c, 0);
+		SAVE_REGISTER(program_counter, 0);
+		SAVE_REGISTER(stack_pointer, 0);
+		SAVE_REGISTER(program_counter_region, 0);
+		SAVE_REGISTER(RX0, 0);
+		SAVE_REGISTER(RX1, 0);
+		SAVE_REGISTER(RX2, 0);
+		SAVE_REGISTER(RX3, 0);		
+		SET_DEPTH(1)
+		M = vm->M_SAVER[current_task];
+#ifdef USE_JIT
+		vm->jit_dirty = 1; /*It is a new program.*/
+		JM = vm->JMAP[current_task];
+#endif
+		stack_pointer=0;
+		SET_PCR(0);
+		SET_PC(0);
+#ifndef NO_PREEMPT
+		instruction_counter = 0;
+#endif
+		RX0=0;RX1=0;RX2=0;RX3=0;
+		a=0;b=0;c=0;
+	}TO_USER
+#else
+	L(G_EMULATE):L(G_EMULATE_SEG): SISA_R=14; goto L(G_HALT);
+#endif
+	L(G_RXICMP):
+	{
+		SUU RX0I = RX0;
+		SUU RX1I = RX1;
+		if(RX0I<RX1I)		a=0;
+		else if(RX0I>RX1I)	a=2;
+		else 				a=1;
+	}D
+	L(G_LOGOR): a = a || b; D
+	L(G_LOGAND): a = a && b;D
+	L(G_BOOLIFY): a = (a!=0)D
+	L(G_NOTA): a=(a==0)D
+	L(G_USER_FARISTA):if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	{
+		u* wp = sisa_mem_wp(vm->M_SAVER[current_task], (((UU)c&255)<<16) | (UU)b);
+		if(!wp){SISA_R=12; goto L(G_HALT);}
+		*wp=a;
+		sisa_code_dirty(vm, current_task, (((UU)c&255)<<16) | (UU)b, 1);
+	}D
+	L(G_TASK_PAR):
+	if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	{
+		STASH_REGS;
+		sisa_task_par(vm, b_stash, a_stash);
+		UNSTASH_REGS;
+	}D
+	L(G_TASK_MAX):
+	if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	a = vm->ntasks;
+#ifdef USE_THREADS
+	b = vm->ntasks < SISA_PAR_GROUP ? vm->ntasks : SISA_PAR_GROUP;
+#else
+	b = 1;
+#endif
+	D
+	/*add more insns here. remember the free slots above!*/
+	L(G_TASK_RIC):
+#ifndef NO_PREEMPT
+		if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+		vm->REG_SAVER[current_task].instruction_counter = 0;
+#endif
+	D
+	L(G_USER_FARPAGEL):
+	if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	{
+		STASH_REGS;
+		PROFILE_EVENT(SISA_PROF_USER_FARPAGEL)
+		{
+			u* wp = sisa_mem_wp(M_STASH, a_stash<<8);
+			if(!wp){SISA_R=12; goto L(G_HALT);}
+			memcpy(
+				wp,
+				sisa_mem_rp(vm->M_SAVER[current_task], c_stash<<8),
+				256
+			);
+			sisa_code_dirty(vm, EMULATE_DEPTH * current_task, a_stash<<8, 256);
+		}
+		UNSTASH_REGS;
+	}D
+	L(G_USER_FARPAGEST):
+	if(EMULATE_DEPTH){SISA_R=15; goto L(G_HALT);}
+	{
+		STASH_REGS;
+		PROFILE_EVENT(SISA_PROF_USER_FARPAGEST)
+		{
+			u* wp = sisa_mem_wp(vm->M_SAVER[current_task], c_stash<<8);
+			if(!wp){SISA_R=12; goto L(G_HALT);}
+			memcpy(
+				wp,
+				sisa_mem_rp(M_STASH, a_stash<<8),
+				256
+			);
+			sisa_code_dirty(vm, current_task, c_stash<<8, 256);
+		}
+		UNSTASH_REGS;
+	}D
+	L(G_HALT):
+	if(EMULATE_DEPTH == 0){
+		SISA_RETIRE()
+		dcl(vm);return SISA_RUN_HALTED;
+	} else {
+		SAVE_REGISTER(a, current_task);
+		SAVE_REGISTER(b, current_task);
+		SAVE_REGISTER(c, current_task);
+		SAVE_REGISTER(program_counter, current_task);
+		SAVE_REGISTER(stack_pointer, current_task);
+		SAVE_REGISTER(program_counter_region, current_task);
+		SAVE_REGISTER(RX0, current_task);
+		SAVE_REGISTER(RX1, current_task);
+		SAVE_REGISTER(RX2, current_task);
+		SAVE_REGISTER(RX3, current_task);
+#ifndef NO_PREEMPT
+		SAVE_REGISTER(instruction_counter, current_task);
+#endif
+		if(solo){ /*Back to sisa_task_par, not the kernel.*/
+			u code = SISA_R;
+			SISA_R = 0;
+			return code;
+		}
+		M=vm->M_SAVER[0];
+#ifdef USE_JIT
+		JM = vm->JMAP[0];
+#endif
+		a=SISA_R;SISA_R=0; /*before SET_DEPTH, which changes what SISA_R is in a single copy*/
+		SET_DEPTH(0)
+		LOAD_REGISTER(b, 0);
+		LOAD_REGISTER(c, 0);
+		LOAD_REGISTER(program_counter, 0);
+		LOAD_REGISTER(program_counter_region, 0);
+		LOAD_REGISTER(stack_pointer, 0);
+		LOAD_REGISTER(RX0, 0);
+		LOAD_REGISTER(RX1, 0);
+		LOAD_REGISTER(RX2, 0);
+		LOAD_REGISTER(RX3, 0);
+		TO_KERNEL
+	}
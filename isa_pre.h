@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 typedef unsigned char u;
@@ -9,7 +10,8 @@ typedef signed int SUU;
 typedef unsigned long UU;
 typedef long SUU;
 #endif
-static u R=0;
+/*For counts which outgrow UU, the timer's.*/
+typedef unsigned long long sisa_u64;
 
 #define SEGMENT_PAGES 0x30000
 
@@ -26,13 +28,52 @@ User mode is pre-empted.
 #endif
 
 /*
-	HUGE NOTE:
-	you should alter emulation.hasm if you change this constant!!!
-	the libc is designed specifically to work with this!
+	Guest memory is sparse unless NO_SPARSE_MEMORY is defined, so that emulate shares the kernel's memory
+	instead of copying it. The JIT needs flat memory, so asking for it gets flat memory too.
+*/
+#if !defined(USE_SPARSE_MEMORY) && !defined(NO_SPARSE_MEMORY) && !defined(USE_JIT)
+#define USE_SPARSE_MEMORY
+#endif
+#if defined(USE_SPARSE_MEMORY) && defined(NO_SPARSE_MEMORY)
+#undef USE_SPARSE_MEMORY
+#endif
+
+/*
+	The JIT emits x86-64 code for System V hosts, and expects flat memory, 32 bit RX registers
+	and the computed goto dispatcher.
+*/
+#if defined(USE_JIT) && (!defined(__x86_64__) || defined(_WIN32) || !defined(__GNUC__) ||\
+	!defined(USE_COMPUTED_GOTO) || !defined(USE_UNSIGNED_INT) || defined(USE_SPARSE_MEMORY))
+#undef USE_JIT
+#endif
+/*Translated code doesn't go back through the dispatcher, so the profiler would not see it.*/
+#if defined(USE_JIT) && defined(USE_PROFILE)
+#undef USE_JIT
+#endif
+/*
+	USE_THREADS runs the tasks given to task_par on a pool of POSIX threads.
+	The JIT's code arena is shared by every task, so it can't be used with it.
+	Neither can tasks which are allowed to use devices.
+*/
+#if defined(USE_THREADS) && (defined(_WIN32) || defined(SISA_DEBUGGER) || defined(NO_DEVICE_PRIVILEGE))
+#undef USE_THREADS
+#endif
+#if defined(USE_JIT) && defined(USE_THREADS)
+#undef USE_JIT
+#endif
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+/*
+	The number of user tasks a VM gets when sisa_vm_new isn't given one.
+	task_set picks one with a 16 bit register, so there can't be more than SISA_TASK_LIMIT.
+	emulation.hasm asks with task_max, and uses as many as its task table holds.
 */
 #ifndef SISA_MAX_TASKS
 #define SISA_MAX_TASKS 8
 #endif
+#define SISA_TASK_LIMIT 0xffFF
 
 
 
@@ -44,10 +85,335 @@ typedef struct {
 	U a,b,c,program_counter,stack_pointer;
 	u program_counter_region;
 }sisa_regfile;
-static u M_SAVER[1+SISA_MAX_TASKS][0x1000000] = {0};
-static u SEGS[1+SISA_MAX_TASKS][SEGMENT_PAGES * 256];
-#define SAVE_REGISTER(XX, d) REG_SAVER[d].XX = XX;
-#define LOAD_REGISTER(XX, d) XX = REG_SAVER[d].XX;
+
+/*
+	Guest memory.
+	With USE_SPARSE_MEMORY, the default, every task's memory and segment are tables of 64k regions
+	(the size of program_counter_region), which are only allocated the first time they are written to.
+	Until then, they read as sisa_zero_region. With NO_SPARSE_MEMORY they are flat arrays instead.
+
+	Regions are reference counted and copy-on-write. emulate hands the new task the kernel's regions
+	instead of copying 16 megabytes, and whichever side writes to a shared region first gets its own copy.
+	So the copy-on-write unit is a whole region, 256 of the 256 byte pages user_farpagel moves:
+	a task costs one 64k copy for each region it writes to, not one for each page.
+	Flat memory has no tables to share, so there emulate still copies all 16 megabytes.
+	Every entry has a read pointer, and a write pointer which is only set while the region is private,
+	so the write path only has to check one pointer.
+
+	MEM_READ(MM, addr) reads a byte.
+	sisa_mem_rp(MM, addr) is a pointer for reading, sisa_mem_wp(MM, addr) a pointer for writing,
+	which is NULL if the region could not be allocated. Neither may be used past the end of the region,
+	which is fine for pages, since a page never straddles two regions.
+	Addresses are not masked, the caller must keep them in range, same as with flat memory.
+*/
+#ifdef USE_SPARSE_MEMORY
+#define SISA_REGION_SIZE 0x10000
+#define SISA_SEG_REGIONS ((SEGMENT_PAGES * 256) / SISA_REGION_SIZE)
+typedef struct{
+	u* r;
+	u* w;
+}sisa_rgn;
+typedef sisa_rgn* sisa_mem;
+static u sisa_zero_region[SISA_REGION_SIZE];
+/*The reference count lives just past the end of the region.*/
+#define SISA_REGION_REFS(rr) (*(UU*)((rr) + SISA_REGION_SIZE))
+static void sisa_region_drop(u* r){
+	if(r == sisa_zero_region) return;
+	if(--SISA_REGION_REFS(r) == 0) free(r);
+}
+/*
+	Tasks running in parallel may share regions with each other, and fault them at the same time.
+	Nothing else changes reference counts while they run.
+*/
+#ifdef USE_THREADS
+static pthread_mutex_t sisa_mem_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SISA_MEM_LOCK() pthread_mutex_lock(&sisa_mem_lock);
+#define SISA_MEM_UNLOCK() pthread_mutex_unlock(&sisa_mem_lock);
+#else
+#define SISA_MEM_LOCK() /*a comment*/
+#define SISA_MEM_UNLOCK() /*a comment*/
+#endif
+/*Give table entry i a private copy of its region.*/
+static u* sisa_mem_fault(sisa_mem MM, UU i){
+	u* r;
+	u* n;
+	SISA_MEM_LOCK()
+	r = MM[i].r;
+	if(r != sisa_zero_region && SISA_REGION_REFS(r) == 1){ /*Everybody else let go of it.*/
+		MM[i].w = r;
+		SISA_MEM_UNLOCK()
+		return r;
+	}
+	n = malloc(SISA_REGION_SIZE + sizeof(UU));
+	if(!n){SISA_MEM_UNLOCK() return NULL;}
+	memcpy(n, r, SISA_REGION_SIZE);
+	SISA_REGION_REFS(n) = 1;
+	sisa_region_drop(r);
+	MM[i].r = n;
+	MM[i].w = n;
+	SISA_MEM_UNLOCK()
+	return n;
+}
+static u sisa_mem_rd(sisa_mem MM, UU addr){
+	return MM[addr>>16].r[addr & 0xffFF];
+}
+static u* sisa_mem_rp(sisa_mem MM, UU addr){
+	return MM[addr>>16].r + (addr & 0xffFF);
+}
+static u* sisa_mem_wp(sisa_mem MM, UU addr){
+	u* w = MM[addr>>16].w;
+	if(!w && !(w = sisa_mem_fault(MM, addr>>16))) return NULL;
+	return w + (addr & 0xffFF);
+}
+/*Point every region of a table at the zero region.*/
+static void sisa_mem_init(sisa_mem MM, UU nregions){
+	UU i;
+	for(i = 0; i < nregions; i++){
+		MM[i].r = sisa_zero_region;
+		MM[i].w = NULL;
+	}
+}
+/*Release every region of a table, leaving it all zeroes.*/
+static void sisa_mem_clear(sisa_mem MM, UU nregions){
+	UU i;
+	for(i = 0; i < nregions; i++) sisa_region_drop(MM[i].r);
+	sisa_mem_init(MM, nregions);
+}
+/*Make dst a copy-on-write copy of src.*/
+static void sisa_mem_share(sisa_mem dst, sisa_mem src, UU nregions){
+	UU i;
+	for(i = 0; i < nregions; i++){
+		sisa_region_drop(dst[i].r);
+		dst[i].r = src[i].r;
+		dst[i].w = NULL;
+		src[i].w = NULL;
+		if(src[i].r != sisa_zero_region) SISA_REGION_REFS(src[i].r)++;
+	}
+}
+#define MEM_READ(MM, addr) sisa_mem_rd(MM, addr)
+#else
+typedef u* sisa_mem;
+#define MEM_READ(MM, addr) ((MM)[addr])
+#define sisa_mem_rp(MM, addr) ((MM) + (addr))
+#define sisa_mem_wp(MM, addr) ((MM) + (addr))
+#endif
+
+/*
+	Multi-byte accesses. Guest memory is big endian.
+	SISA_NOWRAP(addr, n) is true when the n bytes at addr are contiguous on the host, meaning they don't
+	wrap around the end of memory or, with sparse memory, run into the next region. Those are done with
+	a single host load or store, byte swapped on little endian hosts. Anything else goes a byte at a time.
+*/
+#ifdef USE_SPARSE_MEMORY
+#define SISA_NOWRAP(addr, n) (((addr) & 0xffFF) <= 0x10000 - (n))
+#else
+#define SISA_NOWRAP(addr, n) ((addr) <= 0x1000000 - (n))
+#endif
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __SIZEOF_INT__ == 4
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SISA_BSWAP16(x) __builtin_bswap16(x)
+#define SISA_BSWAP32(x) __builtin_bswap32(x)
+#else
+#define SISA_BSWAP16(x) (x)
+#define SISA_BSWAP32(x) (x)
+#endif
+static U sisa_get2(const u* p){unsigned short v; memcpy(&v, p, 2); return SISA_BSWAP16(v);}
+static UU sisa_get4(const u* p){unsigned int v; memcpy(&v, p, 4); return SISA_BSWAP32(v);}
+static void sisa_put2(u* p, U x){unsigned short v = SISA_BSWAP16(x); memcpy(p, &v, 2);}
+static void sisa_put4(u* p, UU x){unsigned int v = SISA_BSWAP32((unsigned int)x); memcpy(p, &v, 4);}
+#else
+static U sisa_get2(const u* p){return ((U)p[0]<<8) | p[1];}
+static UU sisa_get4(const u* p){return ((UU)p[0]<<24) | ((UU)p[1]<<16) | ((UU)p[2]<<8) | p[3];}
+static void sisa_put2(u* p, U x){p[0] = x>>8; p[1] = x;}
+static void sisa_put4(u* p, UU x){p[0] = x>>24; p[1] = x>>16; p[2] = x>>8; p[3] = x;}
+#endif
+/*Read 2 or 4 bytes at addr, wrapping at 16 megabytes.*/
+static U sisa_mem_rd2(sisa_mem MM, UU addr){
+	if(SISA_NOWRAP(addr, 2)) return sisa_get2(sisa_mem_rp(MM, addr));
+	return ((U)MEM_READ(MM, addr)<<8) | MEM_READ(MM, (addr+1) & 0xffFFff);
+}
+static UU sisa_mem_rd4(sisa_mem MM, UU addr){
+	if(SISA_NOWRAP(addr, 4)) return sisa_get4(sisa_mem_rp(MM, addr));
+	return	((UU)MEM_READ(MM, addr)<<24) |
+			((UU)MEM_READ(MM, (addr+1) & 0xffFFff)<<16) |
+			((UU)MEM_READ(MM, (addr+2) & 0xffFFff)<<8) |
+			(UU)MEM_READ(MM, (addr+3) & 0xffFFff);
+}
+/*Same, but wrapping around the end of 64k region r instead.*/
+static U sisa_mem_rd2r(sisa_mem MM, UU r, U off){
+	if(off <= 0xfffe) return sisa_get2(sisa_mem_rp(MM, (r<<16) | off));
+	return ((U)MEM_READ(MM, (r<<16) | off)<<8) | MEM_READ(MM, (r<<16) | (U)(off+1));
+}
+static UU sisa_mem_rd4r(sisa_mem MM, UU r, U off){
+	if(off <= 0xfffc) return sisa_get4(sisa_mem_rp(MM, (r<<16) | off));
+	return	((UU)MEM_READ(MM, (r<<16) | off)<<24) |
+			((UU)MEM_READ(MM, (r<<16) | (U)(off+1))<<16) |
+			((UU)MEM_READ(MM, (r<<16) | (U)(off+2))<<8) |
+			(UU)MEM_READ(MM, (r<<16) | (U)(off+3));
+}
+
+/*
+	Driver state belonging to a single VM. Defined by the driver (d.h).
+*/
+struct sisa_dev;
+struct sisa_jit;
+struct sisa_prof;
+struct sisa_pool;
+struct sisa_vm;
+
+/*
+	The device bus.
+	interrupt looks up a handler by a in a table, which the driver (d.h) fills in when the VM is made,
+	and which host code can add its own devices to, or take the driver's away from, with sisa_irq_set.
+	Numbers nobody handles return a.
+*/
+typedef struct sisa_irq{
+	U a;
+	U b;
+	U c;
+	U stack_pointer;
+	U program_counter;
+	u program_counter_region;
+	UU RX0;
+	UU RX1;
+	UU RX2;
+	UU RX3;
+	sisa_mem M; /*the caller's memory*/
+	UU t; /*the task it belongs to, 0 for the kernel*/
+}sisa_irq;
+typedef U (*sisa_irq_fn)(struct sisa_vm* vm, const sisa_irq* q, void* user);
+typedef struct sisa_irq_ent{
+	sisa_irq_fn fn;
+	void* user;
+}sisa_irq_ent;
+
+/*
+	Everything one instance of the virtual machine owns.
+	sisa_run() only touches memory through this, so any number of these
+	may be run in the same process, one per thread.
+*/
+typedef struct sisa_vm{
+	/*
+		Per task state is indexed by task, 0 being the kernel, up to ntasks.
+		A task's memory is only allocated the first time task_set picks it, until then M_SAVER[t] is NULL.
+	*/
+	UU ntasks;
+	sisa_mem* M_SAVER;
+	sisa_mem* SEGS;
+	sisa_regfile* REG_SAVER;
+	/*Where sisa_run ran out of budget.*/
+	sisa_regfile live;
+	u live_depth; /*0 in the kernel, 1 in a user task*/
+	U live_task;
+	u live_saved; /*set until the next sisa_run picks it up*/
+	u R; /*Error code.*/
+	/*Tasks task_par already ran, and the codes they halted with, for the next TB of each.*/
+	u* task_done;
+	u* task_code;
+#ifdef USE_THREADS
+	u* TASK_R; /*vm->R, for each task, see isa.h*/
+	struct sisa_pool* pool;
+#endif
+	struct sisa_dev* dev;
+	sisa_u64 insns; /*instructions run, see SISA_RETIRE in isa.h*/
+	sisa_u64 timer_at; /*the timer's deadline on sisa_now_ns(), 0 when there is none*/
+	u timer_fired; /*it went off since the kernel last asked*/
+	sisa_irq_ent* IRQ[0x100]; /*handlers by the high byte of a, then the low one. NULL where there are none.*/
+#ifdef USE_JIT
+	struct sisa_jit* jit;
+	u** JMAP; /*which parts of each task's memory have been translated*/
+	u jit_dirty; /*something translated was written to, throw it all away before running any more*/
+#endif
+#ifdef USE_PROFILE
+	struct sisa_prof* prof; /*NULL unless profiling*/
+#endif
+}sisa_vm;
+#ifdef USE_JIT
+#include "jit.h"
+#endif
+#ifdef USE_PROFILE
+#include "profile.h"
+#endif
+
+/*Handle interrupts first to last with fn, or stop handling them if fn is NULL. Returns 0 if out of memory.*/
+static int sisa_irq_set(sisa_vm* vm, U first, U last, sisa_irq_fn fn, void* user){
+	UU i;
+	for(i = first; i <= last; i++){
+		sisa_irq_ent** pg = vm->IRQ + (i >> 8);
+		if(!*pg && !(*pg = calloc(0x100, sizeof(sisa_irq_ent)))) return 0;
+		(*pg)[i & 0xff].fn = fn;
+		(*pg)[i & 0xff].user = user;
+	}
+	return 1;
+}
+static U sisa_irq_dispatch(sisa_vm* vm, const sisa_irq* q){
+	sisa_irq_ent* pg = vm->IRQ[q->a >> 8];
+	if(pg && pg[q->a & 0xff].fn) return pg[q->a & 0xff].fn(vm, q, pg[q->a & 0xff].user);
+	return q->a;
+}
+
+/*
+	Nanoseconds on a monotonic clock, for the timer. Without one it falls back to clock(),
+	which is the processor time used, as the clock instruction is.
+*/
+static sisa_u64 sisa_now_ns(void){
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (sisa_u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+	return (sisa_u64)((double)clock() * (1000000000.0 / CLOCKS_PER_SEC));
+#endif
+}
+/*Has the deadline passed? It only goes off once.*/
+static int sisa_timer_due(sisa_vm* vm){
+	if(!vm->timer_at || sisa_now_ns() < vm->timer_at) return 0;
+	vm->timer_at = 0;
+	vm->timer_fired = 1;
+	return 1;
+}
+
+#ifdef USE_JIT
+/*[addr, addr+len) of task t's memory was changed behind the interpreter's back.*/
+static void sisa_code_dirty(sisa_vm* vm, UU t, UU addr, UU len){
+	UU i;
+	if(!vm->jit || t > vm->ntasks) return;
+	for(i = addr >> SISA_JIT_GRAIN; i <= ((addr + len - 1) >> SISA_JIT_GRAIN); i++)
+		if(vm->JMAP[t][i & (SISA_JIT_MAP-1)]) {vm->jit_dirty = 1; return;}
+}
+#else
+#define sisa_code_dirty(vm, t, addr, len) ((void)(vm),(void)(t),(void)(addr),(void)(len))
+#endif
+
+/*
+	Give task t its memory, the first time task_set picks it. Returns 0 if it cannot be allocated.
+	The memory goes last, so a task has everything else once M_SAVER[t] is set.
+*/
+static int sisa_task_new(sisa_vm* vm, UU t){
+	sisa_mem m, s;
+	if(vm->M_SAVER[t]) return 1;
+#ifdef USE_JIT
+	if(vm->jit && !sisa_jit_task(vm, t)) return 0;
+#endif
+#ifdef USE_SPARSE_MEMORY
+	m = malloc(0x100 * sizeof(sisa_rgn));
+	s = malloc(SISA_SEG_REGIONS * sizeof(sisa_rgn));
+	if(!m || !s){free(m); free(s); return 0;}
+	sisa_mem_init(m, 0x100);
+	sisa_mem_init(s, SISA_SEG_REGIONS);
+#else
+	m = calloc(1, 0x1000000);
+	s = calloc(1, SEGMENT_PAGES * 256);
+	if(!m || !s){free(m); free(s); return 0;}
+#endif
+	vm->SEGS[t] = s;
+	vm->M_SAVER[t] = m;
+	return 1;
+}
+#define SAVE_REGISTER(XX, d) vm->REG_SAVER[d].XX = XX;
+#define LOAD_REGISTER(XX, d) XX = vm->REG_SAVER[d].XX;
+#define SAVE_LIVE(XX) vm->live.XX = XX;
+#define LOAD_LIVE(XX) XX = vm->live.XX;
 
 #ifdef ATTRIB_NOINLINE
 #define DONT_WANT_TO_INLINE_THIS __attribute__ ((noinline))
@@ -55,3 +421,13 @@ static u SEGS[1+SISA_MAX_TASKS][SEGMENT_PAGES * 256];
 #define DONT_WANT_TO_INLINE_THIS /*A comment.*/
 #endif
 
+/*
+	GCC's SLP vectorizer packs the registers together where they are saved into the VM,
+	and the packed copies leak into the dispatch, which then stops being threaded.
+*/
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__TINYC__)
+#define SISA_DISPATCH_OPTS __attribute__ ((optimize("no-tree-slp-vectorize")))
+#else
+#define SISA_DISPATCH_OPTS /*A comment.*/
+#endif
+
@@ -0,0 +1,684 @@
+/*
+	Basic block compiler to x86-64, for USE_JIT.
+
+	A branch target which keeps getting hit has the straight-line code from there translated,
+	up to and including the next branch, or up to the first instruction it does not handle
+	(anything privileged, device or emulate related, division, floating point).
+	While translated code runs, a, b, c, stack_pointer and RX0-RX3 live in host registers,
+	and blocks jump straight to each other through the lookup table without coming back to e().
+	Whatever the table does not have is handed back to e(), which carries on at that address.
+
+	A user task's block pays for all of its instructions before it starts. If that would go past
+	PREEMPT_TIMER the block is left to e(), which stops at exactly the instruction it always did.
+
+	Every task has a map of which 16 byte chunks of its memory have been translated.
+	A store into one of them throws away everything translated, in every task.
+*/
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define SISA_JIT_ARENA		0x1000000	/*bytes of machine code before everything is thrown away*/
+#define SISA_JIT_TBL		0x1000		/*lookup table entries per task*/
+#define SISA_JIT_HOT		16			/*hits before a target is compiled*/
+#define SISA_JIT_INSNS		64			/*longest block*/
+#define SISA_JIT_ROOM		0x4000		/*more than the biggest block can take*/
+#define SISA_JIT_GRAIN		4			/*log2 of the bytes per entry in a translated memory map*/
+#define SISA_JIT_MAP		(0x1000000 >> SISA_JIT_GRAIN)
+
+typedef struct{
+	UU key; /*effective address*/
+	UU hits;
+	const void* code; /*NULL until compiled*/
+}sisa_jit_ent;
+/*The translated code finds entries by shifting, so this must hold.*/
+typedef char sisa_jit_ent_is_16_bytes[sizeof(sisa_jit_ent) == 16 ? 1 : -1];
+
+/*Registers going in and out of translated code.*/
+typedef struct{
+	UU a,b,c,stack_pointer,RX0,RX1,RX2,RX3,instruction_counter;
+	UU pc; /*effective address to continue at*/
+	UU smc; /*non-zero if a store hit translated code*/
+	u* M;
+	u* map;
+	sisa_jit_ent* tbl;
+}sisa_jit_state;
+
+typedef struct sisa_jit{
+	sisa_jit_state st;
+	u* arena; /*NULL if the host would not give us executable memory*/
+	UU used;
+	UU base; /*end of the entry and exit code at the start of the arena*/
+	u* exit;
+	void (*enter)(sisa_jit_state*, const void*);
+	u* has; /*the task has anything translated*/
+	sisa_jit_ent** tbl; /*SISA_JIT_TBL entries for each task, allocated with its memory*/
+}sisa_jit;
+
+/*
+	Host registers.
+	While translated code runs, they hold the guest registers as follows.
+	eax, ecx, edx and esi are scratch.
+*/
+#define JX_RAX 0
+#define JX_RCX 1
+#define JX_RDX 2
+#define JX_RBX 3 /*M*/
+#define JX_RBP 5 /*instruction_counter*/
+#define JX_RSI 6
+#define JX_RDI 7 /*sisa_jit_state*/
+#define JX_A   8
+#define JX_B   9
+#define JX_C   10
+#define JX_RX(i) (11+(i))
+#define JX_SP  15
+#define JX_ABC(i) (8+(i))
+
+#define JX_ADD 0x01
+#define JX_OR  0x09
+#define JX_AND 0x21
+#define JX_SUB 0x29
+#define JX_XOR 0x31
+#define JX_CMP 0x39
+
+/*Condition codes.*/
+#define JX_B_  0x2
+#define JX_E   0x4
+#define JX_NE  0x5
+#define JX_A_  0x7
+#define JX_L   0xC
+#define JX_G   0xF
+
+typedef struct{
+	u* p; /*where the next byte goes*/
+	u* entry; /*the start of the block, for branches back to it*/
+	u* exit;
+	UU start; /*effective address of the block*/
+	UU n; /*instructions in the block*/
+	int counted; /*takes its instructions out of instruction_counter*/
+}jx_ctx;
+
+static void jx_b(jx_ctx* x, UU v){*x->p++ = v;}
+static void jx_d(jx_ctx* x, UU v){jx_b(x, v); jx_b(x, v>>8); jx_b(x, v>>16); jx_b(x, v>>24);}
+/*byte registers spl through dil need a REX prefix to be told apart from ah through bh*/
+static void jx_rex(jx_ctx* x, UU w, UU r, UU i, UU b, int force){
+	UU v = 0x40 | (w<<3) | ((r>>3)<<2) | ((i>>3)<<1) | (b>>3);
+	if(v != 0x40 || force) jx_b(x, v);
+}
+static void jx_op(jx_ctx* x, UU op){
+	if(op > 0xff) jx_b(x, op>>8);
+	jx_b(x, op);
+}
+/*op reg, rm between registers. op may be two bytes.*/
+static void jx_rr(jx_ctx* x, UU op, UU reg, UU rm){
+	jx_rex(x, 0, reg, 0, rm, 0);
+	jx_op(x, op);
+	jx_b(x, 0xC0 | ((reg&7)<<3) | (rm&7));
+}
+/*Same, where rm is a byte register.*/
+static void jx_rb(jx_ctx* x, UU op, UU reg, UU rm){
+	jx_rex(x, 0, reg, 0, rm, rm >= 4);
+	jx_op(x, op);
+	jx_b(x, 0xC0 | ((reg&7)<<3) | (rm&7));
+}
+/*op reg, [rbx + idx + disp]*/
+static void jx_mb(jx_ctx* x, UU op, UU reg, UU idx, UU disp){
+	jx_rex(x, 0, reg, idx, JX_RBX, 0);
+	jx_op(x, op);
+	jx_b(x, (disp ? 0x44 : 0x04) | ((reg&7)<<3));
+	jx_b(x, ((idx&7)<<3) | JX_RBX);
+	if(disp) jx_b(x, disp);
+}
+/*op reg, [rdi + off], off being a field of sisa_jit_state*/
+static void jx_ms(jx_ctx* x, UU w, UU op, UU reg, UU off){
+	jx_rex(x, w, reg, 0, JX_RDI, 0);
+	jx_op(x, op);
+	jx_b(x, 0x80 | ((reg&7)<<3) | JX_RDI);
+	jx_d(x, off);
+}
+#define jx_mov(x, d, s)		jx_rr(x, 0x89, s, d)
+#define jx_alu(x, op, d, s)	jx_rr(x, op, s, d)
+#define jx_zx16(x, r)		jx_rr(x, 0x0FB7, r, r)
+#define jx_zx8(x, d, s)		jx_rb(x, 0x0FB6, d, s)
+#define jx_imul(x, d, s)	jx_rr(x, 0x0FAF, d, s)
+#define jx_test(x, r)		jx_rr(x, 0x85, r, r)
+#define jx_setcc(x, cc, r)	jx_rb(x, 0x0F90 | (cc), 0, r)
+#define jx_not(x, r)		jx_rr(x, 0xF7, 2, r)
+#define jx_inc(x, r)		jx_rr(x, 0xFF, 0, r)
+#define jx_dec(x, r)		jx_rr(x, 0xFF, 1, r)
+#define jx_shlcl(x, r)		jx_rr(x, 0xD3, 4, r)
+#define jx_shrcl(x, r)		jx_rr(x, 0xD3, 5, r)
+/*81 /ext with a 32 bit immediate: 0 add, 4 and, 5 sub, 7 cmp*/
+static void jx_alui(jx_ctx* x, UU ext, UU r, UU imm){jx_rr(x, 0x81, ext, r); jx_d(x, imm);}
+static void jx_shl(jx_ctx* x, UU r, UU n){jx_rr(x, 0xC1, 4, r); jx_b(x, n);}
+static void jx_shr(jx_ctx* x, UU r, UU n){jx_rr(x, 0xC1, 5, r); jx_b(x, n);}
+static void jx_movi(jx_ctx* x, UU r, UU imm){
+	jx_rex(x, 0, 0, 0, r, 0);
+	jx_b(x, 0xB8 | (r&7));
+	jx_d(x, imm);
+}
+/*lea d, [s + disp]*/
+static void jx_lea(jx_ctx* x, UU d, UU s, UU disp){
+	jx_rex(x, 0, d, 0, s, 0);
+	jx_b(x, 0x8D);
+	jx_b(x, 0x40 | ((d&7)<<3) | (s&7));
+	if((s&7) == 4) jx_b(x, 0x24);
+	jx_b(x, disp);
+}
+/*Jumps are emitted with no target, jx_to() fills it in.*/
+static u* jx_jcc(jx_ctx* x, UU cc){jx_b(x, 0x0F); jx_b(x, 0x80 | cc); jx_d(x, 0); return x->p - 4;}
+static u* jx_jmp(jx_ctx* x){jx_b(x, 0xE9); jx_d(x, 0); return x->p - 4;}
+static void jx_to(u* at, const u* target){
+	int rel = (int)(target - (at + 4));
+	memcpy(at, &rel, 4);
+}
+
+/*Back to e(), at pc, with done instructions out of the block's n run.*/
+static void jx_leave(jx_ctx* x, UU pc, UU done){
+	if(x->counted && done < x->n) jx_alui(x, 5, JX_RBP, x->n - done);
+	jx_movi(x, JX_RAX, pc);
+	jx_to(jx_jmp(x), x->exit);
+}
+/*Go on to the effective address in eax: this block again, whatever the table has for it, or e().*/
+static void jx_next(jx_ctx* x){
+	jx_alui(x, 7, JX_RAX, x->start);
+	jx_to(jx_jcc(x, JX_E), x->entry);
+	jx_mov(x, JX_RCX, JX_RAX);
+	jx_alui(x, 4, JX_RCX, SISA_JIT_TBL - 1);
+	jx_shl(x, JX_RCX, 4);
+	jx_ms(x, 1, 0x03, JX_RCX, offsetof(sisa_jit_state, tbl));	/*add rcx, [rdi+tbl]*/
+	jx_b(x, 0x39); jx_b(x, 0x01);								/*cmp [rcx], eax*/
+	jx_to(jx_jcc(x, JX_NE), x->exit);
+	jx_b(x, 0x48); jx_b(x, 0x8B); jx_b(x, 0x49); jx_b(x, offsetof(sisa_jit_ent, code)); /*mov rcx, [rcx+code]*/
+	jx_b(x, 0x48); jx_b(x, 0x85); jx_b(x, 0xC9);				/*test rcx, rcx*/
+	jx_to(jx_jcc(x, JX_E), x->exit);
+	jx_b(x, 0xFF); jx_b(x, 0xE1);								/*jmp rcx*/
+}
+/*Leave for e() if the instruction before stored into translated code.*/
+static void jx_smc(jx_ctx* x, UU pc, UU done){
+	u* over;
+	jx_ms(x, 0, 0x83, 7, offsetof(sisa_jit_state, smc)); jx_b(x, 0); /*cmp dword [rdi+smc], 0*/
+	over = jx_jcc(x, JX_E);
+	jx_leave(x, pc, done);
+	jx_to(over, x->p);
+}
+
+/*
+	Memory. The address goes in esi, and then byte k of the access is read or written at
+	JX_NARROW: esi+k, which is never more than 0x10003
+	JX_WIDE: (esi+k)&0xffFFff
+	JX_FAR: ((c&255)<<16) | ((esi+k)&0xffFF)
+	Which is what the instructions do in e().
+*/
+#define JX_NARROW 0
+#define JX_WIDE 1
+#define JX_FAR 2
+static void jx_addr(jx_ctx* x, UU mode, UU k, UU* idx, UU* disp){
+	if(mode == JX_NARROW){*idx = JX_RSI; *disp = k; return;}
+	jx_lea(x, JX_RCX, JX_RSI, k);
+	if(mode == JX_WIDE)
+		jx_alui(x, 4, JX_RCX, 0xffFFff);
+	else {
+		jx_zx16(x, JX_RCX);
+		jx_zx8(x, JX_RDX, JX_C);
+		jx_shl(x, JX_RDX, 16);
+		jx_alu(x, JX_OR, JX_RCX, JX_RDX);
+	}
+	*idx = JX_RCX; *disp = 0;
+}
+/*nb bytes, big endian, into eax.*/
+static void jx_load(jx_ctx* x, UU mode, UU nb){
+	UU k, idx, disp;
+	if(mode == JX_NARROW && nb == 4){
+		jx_mb(x, 0x8B, JX_RAX, JX_RSI, 0);
+		jx_b(x, 0x0F); jx_b(x, 0xC8); /*bswap eax*/
+		return;
+	}
+	for(k = 0; k < nb; k++){
+		jx_addr(x, mode, k, &idx, &disp);
+		jx_mb(x, 0x0FB6, k ? JX_RDX : JX_RAX, idx, disp);
+		if(k){
+			jx_shl(x, JX_RAX, 8);
+			jx_alu(x, JX_OR, JX_RAX, JX_RDX);
+		}
+	}
+}
+/*nb bytes of eax, big endian. Marks smc if any of them land on translated code.*/
+static void jx_store(jx_ctx* x, UU mode, UU nb){
+	UU k, idx, disp;
+	for(k = 0; k < nb; k++){
+		jx_addr(x, mode, k, &idx, &disp);
+		jx_mov(x, JX_RDX, JX_RAX);
+		if(k < nb-1) jx_shr(x, JX_RDX, 8*(nb-1-k));
+		jx_mb(x, 0x88, JX_RDX, idx, disp);
+		if(idx != JX_RCX || disp) jx_lea(x, JX_RCX, idx, disp);
+		jx_shr(x, JX_RCX, SISA_JIT_GRAIN);
+		jx_ms(x, 1, 0x8B, JX_RDX, offsetof(sisa_jit_state, map));
+		jx_b(x, 0x0F); jx_b(x, 0xB6); jx_b(x, 0x14); jx_b(x, 0x0A);	/*movzx edx, byte [rdx+rcx]*/
+		jx_ms(x, 0, 0x09, JX_RDX, offsetof(sisa_jit_state, smc));		/*or [rdi+smc], edx*/
+	}
+}
+/*esi = ((c&255)<<16) | lo*/
+static void jx_far(jx_ctx* x, UU lo){
+	jx_zx8(x, JX_RSI, JX_C);
+	jx_shl(x, JX_RSI, 16);
+	jx_alu(x, JX_OR, JX_RSI, lo);
+}
+/*a = 1 + (above) - (below), the flags being set by a compare.*/
+static void jx_cmp3(jx_ctx* x, int is_signed){
+	jx_movi(x, JX_A, 0);
+	jx_movi(x, JX_RCX, 0);
+	jx_setcc(x, is_signed ? JX_G : JX_A_, JX_A);
+	jx_setcc(x, is_signed ? JX_L : JX_B_, JX_RCX);
+	jx_alu(x, JX_SUB, JX_A, JX_RCX);
+	jx_inc(x, JX_A);
+}
+
+/*Length of an instruction that can be translated, 0 if it cannot.*/
+static UU jx_len(u op){
+	switch(op){
+		case 2: case 4: return 2;
+		case 1: case 3: case 5: case 6: case 7: case 32: case 34:
+		case 49: case 50: case 51: case 52: case 53: return 3;
+		case 139: case 140: case 141: case 142: return 5;
+		case 8: case 9: case 10: case 13: case 14: case 15: case 18: case 19: case 20: case 21: case 22:
+		case 23: case 24: case 25: case 26: case 27: case 28: case 29: case 30: case 31:
+		case 33: case 35: case 36: case 37: case 38: case 39: case 40: case 41: case 42: case 43:
+		case 44: case 45: case 46: case 47: case 48: case 54: case 55: case 56: case 57: case 58: case 59:
+		case 60: case 61: case 62: case 63: case 64: case 65: case 68: case 69: case 70:
+		case 71: case 72: case 73: case 74:
+		case 143: case 144: case 145: case 146: case 147: case 148: case 149: case 150:
+		case 151: case 152: case 153: case 156: case 157:
+		case 158: case 159: case 160: case 161: case 162: case 163: case 164: case 165:
+		case 166: case 167: case 168: case 169: case 170:
+		case 179: case 180: case 181: case 182: case 183: case 184: case 185: case 186:
+		case 203: case 204: case 205: case 206: case 211: case 212: case 213: case 214: case 215:
+			return 1;
+	}
+	if(op >= 91 && op <= 100) return 1;	/*push and pop*/
+	if(op >= 103 && op <= 138) return 1;	/*register moves*/
+	if(op >= 189 && op <= 202) return 4;	/*24 bit addressed loads and stores*/
+	return 0;
+}
+/*Changes the program counter.*/
+static int jx_ends(u op){
+	return op == 14 || op == 15 || op == 48 || op == 60 || op == 61 ||
+			op == 68 || op == 69 || op == 70 || op == 182;
+}
+/*Stores to memory.*/
+static int jx_stores(u op){
+	return op == 6 || op == 7 || (op >= 44 && op <= 47) || (op >= 49 && op <= 51) ||
+			op == 60 || op == 63 || op == 65 || op == 69 || op == 72 || op == 74 ||
+			(op >= 91 && op <= 95) || (op >= 147 && op <= 150) || (op >= 158 && op <= 161) ||
+			op == 183 || op == 184 || (op >= 196 && op <= 202);
+}
+
+/*
+	One instruction. pc is the address of the instruction after it, within the region pcr.
+	Control transfers finish the block by going to the next one.
+*/
+static void jx_insn(jx_ctx* x, u op, UU imm, UU pcr, UU pc){
+	UU i;
+	switch(op){
+		case 30: break;
+		case 18: jx_alu(x, JX_AND, JX_A, JX_B); break;
+		case 19: jx_alu(x, JX_OR, JX_A, JX_B); break;
+		case 20: jx_alu(x, JX_XOR, JX_A, JX_B); break;
+		case 8: jx_alu(x, JX_ADD, JX_A, JX_B); jx_zx16(x, JX_A); break;
+		case 9: jx_alu(x, JX_SUB, JX_A, JX_B); jx_zx16(x, JX_A); break;
+		case 10: jx_imul(x, JX_A, JX_B); jx_zx16(x, JX_A); break;
+		case 13: jx_alu(x, JX_CMP, JX_A, JX_B); jx_cmp3(x, 0); break;
+		case 21: jx_mov(x, JX_RCX, JX_B); jx_shlcl(x, JX_A); jx_zx16(x, JX_A); break;
+		case 22: jx_mov(x, JX_RCX, JX_B); jx_shrcl(x, JX_A); break;
+		case 25: case 31: /*cab, cba*/
+			jx_mov(x, JX_RAX, op == 25 ? JX_A : JX_B); jx_shl(x, JX_RAX, 8);
+			jx_zx8(x, JX_RCX, op == 25 ? JX_B : JX_A);
+			jx_alu(x, JX_OR, JX_RAX, JX_RCX);
+			jx_rr(x, 0x0FB7, JX_C, JX_RAX);
+		break;
+		case 26: jx_mov(x, JX_A, JX_B); break;
+		case 27: jx_mov(x, JX_B, JX_A); break;
+		case 28: jx_zx8(x, JX_A, JX_C); break;
+		case 29: jx_mov(x, JX_A, JX_C); jx_shr(x, JX_A, 8); break;
+		case 2: case 32: jx_movi(x, JX_A, imm); break;
+		case 4: case 34: jx_movi(x, JX_B, imm); break;
+		case 5: jx_movi(x, JX_C, imm); break;
+		case 40: jx_mov(x, JX_C, JX_A); break;
+		case 41: jx_mov(x, JX_C, JX_B); break;
+		case 42: jx_mov(x, JX_A, JX_C); break;
+		case 43: jx_mov(x, JX_B, JX_C); break;
+		case 52: jx_alui(x, 0, JX_SP, imm); jx_zx16(x, JX_SP); break;
+		case 53: jx_alui(x, 5, JX_SP, imm); jx_zx16(x, JX_SP); break;
+		case 54: jx_alu(x, JX_ADD, JX_SP, JX_A); jx_zx16(x, JX_SP); break;
+		case 55: jx_alu(x, JX_SUB, JX_SP, JX_A); jx_zx16(x, JX_SP); break;
+		case 56: jx_mov(x, JX_A, JX_SP); break;
+		case 57: jx_mov(x, JX_B, JX_SP); break;
+		case 58: jx_not(x, JX_A); jx_zx16(x, JX_A); break;
+		case 59: jx_movi(x, JX_C, pc); break;
+		/*loads*/
+		case 1: case 3: jx_movi(x, JX_RSI, imm); jx_load(x, JX_NARROW, 1); jx_mov(x, op == 1 ? JX_A : JX_B, JX_RAX); break;
+		case 23: jx_mb(x, 0x0FB6, JX_A, JX_C, 0); break;
+		case 24: jx_mb(x, 0x0FB6, JX_B, JX_C, 0); break;
+		case 33: case 35: case 36: case 37: case 38: case 39:{
+			/*illda, illdb, then through a, b, b, a*/
+			static const u via[6] = {JX_C, JX_C, JX_A, JX_B, JX_B, JX_A};
+			static const u to[6] = {JX_A, JX_B, JX_A, JX_B, JX_A, JX_B};
+			i = op == 33 ? 0 : op == 35 ? 1 : op - 34;
+			jx_mov(x, JX_RSI, via[i]); jx_load(x, JX_NARROW, 2); jx_mov(x, to[i], JX_RAX);
+		}break;
+		case 99: case 100: case 96: case 97: case 98: /*pops*/
+			i = op >= 99 ? 1 : 2;
+			jx_alui(x, 5, JX_SP, i); jx_zx16(x, JX_SP);
+			jx_mov(x, JX_RSI, JX_SP); jx_load(x, JX_NARROW, i);
+			jx_mov(x, op == 99 || op == 96 ? JX_A : op == 100 || op == 97 ? JX_B : JX_C, JX_RAX);
+		break;
+		case 162: case 163: case 164: case 165:
+			jx_alui(x, 5, JX_SP, 4); jx_zx16(x, JX_SP);
+			jx_mov(x, JX_RSI, JX_SP); jx_load(x, JX_NARROW, 4); jx_mov(x, JX_RX(op-162), JX_RAX);
+		break;
+		case 71: jx_far(x, JX_B); jx_load(x, JX_NARROW, 1); jx_mov(x, JX_A, JX_RAX); break;
+		case 73: jx_far(x, JX_A); jx_load(x, JX_NARROW, 1); jx_mov(x, JX_B, JX_RAX); break;
+		case 62: jx_mov(x, JX_RSI, JX_B); jx_load(x, JX_FAR, 2); jx_mov(x, JX_A, JX_RAX); break;
+		case 64: jx_mov(x, JX_RSI, JX_A); jx_load(x, JX_FAR, 2); jx_mov(x, JX_B, JX_RAX); break;
+		case 143: case 144: case 145: case 146:
+			jx_mov(x, JX_RSI, JX_A); jx_load(x, JX_FAR, 4); jx_mov(x, JX_RX(op-143), JX_RAX);
+		break;
+		case 180: case 181:
+			jx_mov(x, JX_RSI, JX_RX(op == 180 ? 1 : 0)); jx_load(x, JX_WIDE, 4); jx_mov(x, JX_RX(0), JX_RAX);
+		break;
+		case 189: case 190: case 191: case 192:
+			jx_movi(x, JX_RSI, imm); jx_load(x, JX_WIDE, 4); jx_mov(x, JX_RX(op-189), JX_RAX);
+		break;
+		case 193: case 194: case 195:
+			jx_movi(x, JX_RSI, imm); jx_load(x, JX_WIDE, 2); jx_mov(x, JX_ABC(op-193), JX_RAX);
+		break;
+		/*stores*/
+		case 6: case 7: jx_movi(x, JX_RSI, imm); jx_mov(x, JX_RAX, op == 6 ? JX_A : JX_B); jx_store(x, JX_NARROW, 1); break;
+		case 44: case 45: jx_mov(x, JX_RSI, JX_C); jx_mov(x, JX_RAX, op == 44 ? JX_A : JX_B); jx_store(x, JX_NARROW, 1); break;
+		case 46: case 47: jx_mov(x, JX_RSI, JX_C); jx_mov(x, JX_RAX, op == 46 ? JX_A : JX_B); jx_store(x, JX_NARROW, 2); break;
+		case 49: case 50: case 51: jx_movi(x, JX_RSI, imm); jx_mov(x, JX_RAX, JX_ABC(op-49)); jx_store(x, JX_NARROW, 2); break;
+		case 63: jx_far(x, JX_B); jx_mov(x, JX_RAX, JX_A); jx_store(x, JX_WIDE, 2); break;
+		case 65: jx_far(x, JX_A); jx_mov(x, JX_RAX, JX_B); jx_store(x, JX_WIDE, 2); break;
+		case 72: jx_far(x, JX_B); jx_mov(x, JX_RAX, JX_A); jx_store(x, JX_NARROW, 1); break;
+		case 74: jx_far(x, JX_A); jx_mov(x, JX_RAX, JX_B); jx_store(x, JX_NARROW, 1); break;
+		case 91: case 92: case 93: case 94: case 95: /*pushes*/
+			i = op >= 94 ? 1 : 2;
+			jx_mov(x, JX_RSI, JX_SP); jx_mov(x, JX_RAX, JX_ABC(op >= 94 ? op-94 : op-91)); jx_store(x, JX_NARROW, i);
+			jx_alui(x, 0, JX_SP, i); jx_zx16(x, JX_SP);
+		break;
+		case 158: case 159: case 160: case 161:
+			jx_mov(x, JX_RSI, JX_SP); jx_mov(x, JX_RAX, JX_RX(op-158)); jx_store(x, JX_NARROW, 4);
+			jx_alui(x, 0, JX_SP, 4); jx_zx16(x, JX_SP);
+		break;
+		case 147: case 148: case 149: case 150:
+			jx_mov(x, JX_RSI, JX_C); jx_shl(x, JX_RSI, 16); jx_alu(x, JX_OR, JX_RSI, JX_A);
+			jx_mov(x, JX_RAX, JX_RX(op-147)); jx_store(x, JX_WIDE, 4);
+		break;
+		case 183: jx_mov(x, JX_RSI, JX_RX(1)); jx_mov(x, JX_RAX, JX_RX(0)); jx_store(x, JX_WIDE, 4); break;
+		case 184: jx_mov(x, JX_RSI, JX_RX(0)); jx_mov(x, JX_RAX, JX_RX(1)); jx_store(x, JX_WIDE, 4); break;
+		case 196: case 197: case 198: case 199:
+			jx_movi(x, JX_RSI, imm); jx_mov(x, JX_RAX, JX_RX(op-196)); jx_store(x, JX_WIDE, 4);
+		break;
+		case 200: case 201: case 202:
+			jx_movi(x, JX_RSI, imm); jx_mov(x, JX_RAX, JX_ABC(op-200)); jx_store(x, JX_WIDE, 2);
+		break;
+		/*32 bit*/
+		case 139: case 140: case 141: case 142: jx_movi(x, JX_RX(op-139), imm); break;
+		case 151: jx_alu(x, JX_ADD, JX_RX(0), JX_RX(1)); break;
+		case 152: jx_alu(x, JX_SUB, JX_RX(0), JX_RX(1)); break;
+		case 153: jx_imul(x, JX_RX(0), JX_RX(1)); break;
+		case 156: jx_mov(x, JX_RCX, JX_RX(1)); jx_shrcl(x, JX_RX(0)); break;
+		case 157: jx_mov(x, JX_RCX, JX_RX(1)); jx_shlcl(x, JX_RX(0)); break;
+		case 166: jx_alu(x, JX_AND, JX_RX(0), JX_RX(1)); break;
+		case 167: jx_alu(x, JX_OR, JX_RX(0), JX_RX(1)); break;
+		case 168: jx_alu(x, JX_XOR, JX_RX(0), JX_RX(1)); break;
+		case 169: jx_not(x, JX_RX(0)); break;
+		case 170: jx_alu(x, JX_CMP, JX_RX(0), JX_RX(1)); jx_cmp3(x, 0); break;
+		case 211: jx_alu(x, JX_CMP, JX_RX(0), JX_RX(1)); jx_cmp3(x, 1); break;
+		case 179: jx_movi(x, JX_RX(0), SEGMENT_PAGES); break;
+		case 185: case 186:
+			jx_mov(x, JX_C, JX_RX(0)); jx_shr(x, JX_C, 16);
+			jx_rr(x, 0x0FB7, op == 185 ? JX_B : JX_A, JX_RX(0));
+		break;
+		case 203: jx_inc(x, JX_A); jx_zx16(x, JX_A); break;
+		case 204: jx_dec(x, JX_A); jx_zx16(x, JX_A); break;
+		case 205: jx_inc(x, JX_RX(0)); break;
+		case 206: jx_dec(x, JX_RX(0)); break;
+		case 212: jx_alu(x, JX_OR, JX_A, JX_B); jx_setcc(x, JX_NE, JX_RAX); jx_zx8(x, JX_A, JX_RAX); break;
+		case 213:
+			jx_test(x, JX_A); jx_setcc(x, JX_NE, JX_RAX);
+			jx_test(x, JX_B); jx_setcc(x, JX_NE, JX_RCX);
+			jx_b(x, 0x20); jx_b(x, 0xC8); /*and al, cl*/
+			jx_zx8(x, JX_A, JX_RAX);
+		break;
+		case 214: case 215: jx_test(x, JX_A); jx_setcc(x, op == 214 ? JX_NE : JX_E, JX_RAX); jx_zx8(x, JX_A, JX_RAX); break;
+		/*control*/
+		case 48: case 14: case 15:{
+			u* skip = NULL;
+			if(op != 48){
+				jx_alui(x, 7, JX_A, 1);
+				skip = jx_jcc(x, op == 14 ? JX_NE : JX_E);
+			}
+			jx_alui(x, 7, JX_C, x->start & 0xffFF);
+			jx_to(jx_jcc(x, JX_E), x->entry);
+			jx_mov(x, JX_RAX, JX_C);
+			if(pcr) jx_alui(x, 1, JX_RAX, pcr << 16);
+			jx_next(x);
+			if(skip){
+				jx_to(skip, x->p);
+				jx_movi(x, JX_RAX, (pcr << 16) | pc);
+				jx_next(x);
+			}
+		}break;
+		case 60: case 69: /*call, farcall*/
+			jx_mov(x, JX_RSI, JX_SP); jx_movi(x, JX_RAX, pc); jx_store(x, JX_NARROW, 2);
+			jx_alui(x, 0, JX_SP, 2); jx_zx16(x, JX_SP);
+			if(op == 69){
+				jx_mov(x, JX_RSI, JX_SP); jx_movi(x, JX_RAX, pcr); jx_store(x, JX_NARROW, 1);
+				jx_inc(x, JX_SP); jx_zx16(x, JX_SP);
+				jx_zx8(x, JX_RAX, JX_A); jx_shl(x, JX_RAX, 16); jx_alu(x, JX_OR, JX_RAX, JX_C);
+			} else {
+				jx_mov(x, JX_RAX, JX_C);
+				if(pcr) jx_alui(x, 1, JX_RAX, pcr << 16);
+			}
+			jx_ms(x, 0, 0x83, 7, offsetof(sisa_jit_state, smc)); jx_b(x, 0);
+			jx_to(jx_jcc(x, JX_NE), x->exit);
+			jx_next(x);
+		break;
+		case 61:
+			jx_alui(x, 5, JX_SP, 2); jx_zx16(x, JX_SP);
+			jx_mov(x, JX_RSI, JX_SP); jx_load(x, JX_NARROW, 2);
+			if(pcr) jx_alui(x, 1, JX_RAX, pcr << 16);
+			jx_next(x);
+		break;
+		case 68: jx_zx8(x, JX_RAX, JX_A); jx_shl(x, JX_RAX, 16); jx_next(x); break;
+		case 70: /*the region byte, then the address under it*/
+			jx_alui(x, 5, JX_SP, 1); jx_zx16(x, JX_SP);
+			jx_mov(x, JX_RSI, JX_SP); jx_load(x, JX_NARROW, 1);
+			jx_mov(x, JX_RCX, JX_RAX); jx_shl(x, JX_RCX, 16);
+			jx_alui(x, 5, JX_SP, 2); jx_zx16(x, JX_SP);
+			jx_mov(x, JX_RSI, JX_SP); jx_load(x, JX_NARROW, 2);
+			jx_alu(x, JX_OR, JX_RAX, JX_RCX);
+			jx_next(x);
+		break;
+		case 182: jx_mov(x, JX_RAX, JX_RX(0)); jx_alui(x, 4, JX_RAX, 0xffFFff); jx_next(x); break;
+		default:
+			if(op >= 103 && op <= 126){
+				UU g = (op - 103) / 6, r = (op - 103) % 6;
+				if(r < 3) jx_rr(x, 0x0FB7, JX_ABC(r), JX_RX(g));
+				else jx_mov(x, JX_RX(g), JX_ABC(r-3));
+			} else if(op >= 127 && op <= 138){
+				UU d = (op - 127) / 3, s = (op - 127) % 3;
+				if(s >= d) s++;
+				jx_mov(x, JX_RX(d), JX_RX(s));
+			}
+		break;
+	}
+}
+
+/*
+	Translate the block at effective address start in task t.
+	limit is PREEMPT_TIMER for blocks which count instructions, 0 otherwise.
+	Returns NULL if the first instruction cannot be translated.
+*/
+static const void* sisa_jit_compile(sisa_vm* vm, UU t, UU start, UU limit){
+	sisa_jit* j = vm->jit;
+	u* M = vm->M_SAVER[t];
+	UU pcr = start >> 16, pc, n, i, len;
+	u* pre = NULL;
+	u op = 0;
+	jx_ctx x;
+	/*Find the length first, the block has to know what it costs before it starts.*/
+	for(pc = start & 0xffFF, n = 0; pc <= 0xfff0 && n < SISA_JIT_INSNS; n++){
+		op = M[(pcr << 16) | pc];
+		len = jx_len(op);
+		if(!len) break;
+		pc += len;
+		if(jx_ends(op)){n++; break;}
+	}
+	if(!n) return NULL;
+	for(i = start >> SISA_JIT_GRAIN; i <= (((pcr << 16) | (pc-1)) >> SISA_JIT_GRAIN); i++)
+		vm->JMAP[t][i] = 1;
+	j->has[t] = 1;
+	x.p = j->arena + j->used;
+	x.entry = x.p;
+	x.exit = j->exit;
+	x.start = start;
+	x.n = n;
+	x.counted = limit != 0;
+	if(x.counted){
+		jx_alui(&x, 0, JX_RBP, n);
+		jx_alui(&x, 7, JX_RBP, limit);
+		pre = jx_jcc(&x, JX_A_);
+	}
+	for(pc = start & 0xffFF, i = 0; i < n; i++){
+		UU imm = 0, k;
+		op = M[(pcr << 16) | pc];
+		len = jx_len(op);
+		for(k = 1; k < len; k++) imm = (imm << 8) | M[(pcr << 16) | (pc + k)];
+		pc += len;
+		jx_insn(&x, op, imm, pcr, pc);
+		if(jx_stores(op) && !jx_ends(op)) jx_smc(&x, (pcr << 16) | pc, i+1);
+	}
+	if(!jx_ends(op)){
+		jx_movi(&x, JX_RAX, (pcr << 16) | pc);
+		jx_next(&x);
+	}
+	if(pre){
+		jx_to(pre, x.p);
+		jx_alui(&x, 5, JX_RBP, n);
+		jx_leave(&x, start, n);
+	}
+	j->used = ((x.p - j->arena) + 15) & ~(UU)15;
+	return x.entry;
+}
+
+/*Throw away everything translated.*/
+static void sisa_jit_flush(sisa_vm* vm){
+	sisa_jit* j = vm->jit;
+	UU t;
+	vm->jit_dirty = 0;
+	for(t = 0; t <= vm->ntasks; t++){
+		if(!j->has[t]) continue;
+		memset(j->tbl[t], 0, SISA_JIT_TBL * sizeof(sisa_jit_ent));
+		memset(vm->JMAP[t], 0, SISA_JIT_MAP);
+		j->has[t] = 0;
+	}
+	j->used = j->base;
+}
+
+/*
+	Translated code for the effective address pc in task t, counting its hits,
+	and compiling it once it is hot. NULL if there is none.
+*/
+static const void* sisa_jit_find(sisa_vm* vm, UU t, UU pc, UU limit){
+	sisa_jit* j = vm->jit;
+	sisa_jit_ent* en;
+	if(!j->arena) return NULL;
+	if(vm->jit_dirty) sisa_jit_flush(vm);
+	en = j->tbl[t] + (pc & (SISA_JIT_TBL-1));
+	if(en->key != pc){en->key = pc; en->hits = 0; en->code = NULL;}
+	if(!en->code){
+		if(en->hits == SISA_JIT_HOT) return NULL; /*could not be translated*/
+		if(++en->hits < SISA_JIT_HOT) return NULL;
+		if(SISA_JIT_ARENA - j->used < SISA_JIT_ROOM){
+			sisa_jit_flush(vm);
+			en->key = pc; en->hits = SISA_JIT_HOT;
+		}
+		en->code = sisa_jit_compile(vm, t, pc, limit);
+		if(!en->code) return NULL;
+	}
+	j->st.tbl = j->tbl[t];
+	j->st.map = vm->JMAP[t];
+	return en->code;
+}
+
+/*Task t's map and table. Returns 0 if out of memory.*/
+static int sisa_jit_task(sisa_vm* vm, UU t){
+	sisa_jit* j = vm->jit;
+	if(!vm->JMAP[t] && !(vm->JMAP[t] = calloc(1, SISA_JIT_MAP))) return 0;
+	if(!j->tbl[t] && !(j->tbl[t] = calloc(SISA_JIT_TBL, sizeof(sisa_jit_ent)))) return 0;
+	return 1;
+}
+static void sisa_jit_free(sisa_vm* vm);
+
+/*
+	Set up the maps, the arena, and the code going in and out of it. Returns 0 if out of memory.
+	If the host will not hand out executable memory, everything is left to e().
+*/
+static int sisa_jit_init(sisa_vm* vm){
+	static const u saved[6] = {JX_RBX, JX_RBP, 12, 13, 14, 15};
+	static const u regs[9] = {JX_A, JX_B, JX_C, JX_SP, JX_RX(0), JX_RX(1), JX_RX(2), JX_RX(3), JX_RBP};
+	static const UU offs[9] = {
+		offsetof(sisa_jit_state, a), offsetof(sisa_jit_state, b), offsetof(sisa_jit_state, c),
+		offsetof(sisa_jit_state, stack_pointer),
+		offsetof(sisa_jit_state, RX0), offsetof(sisa_jit_state, RX1),
+		offsetof(sisa_jit_state, RX2), offsetof(sisa_jit_state, RX3),
+		offsetof(sisa_jit_state, instruction_counter)
+	};
+	sisa_jit* j;
+	jx_ctx x;
+	void* ar;
+	UU t, i;
+	if(vm->jit) return 1;
+	j = calloc(1, sizeof(sisa_jit));
+	if(!j) return 0;
+	vm->jit = j;
+	j->has = calloc(1 + vm->ntasks, 1);
+	j->tbl = calloc(1 + vm->ntasks, sizeof(sisa_jit_ent*));
+	if(!j->has || !j->tbl){sisa_jit_free(vm); return 0;}
+	for(t = 0; t <= vm->ntasks; t++)
+		if(vm->M_SAVER[t] && !sisa_jit_task(vm, t)){sisa_jit_free(vm); return 0;}
+	ar = mmap(NULL, SISA_JIT_ARENA, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ar == MAP_FAILED) return 1;
+	j->arena = ar;
+	x.p = j->arena;
+	/*enter(state in rdi, code in rsi)*/
+	for(i = 0; i < 6; i++){jx_rex(&x, 0, 0, 0, saved[i], 0); jx_b(&x, 0x50 | (saved[i]&7));}
+	jx_ms(&x, 1, 0x8B, JX_RBX, offsetof(sisa_jit_state, M));
+	for(i = 0; i < 9; i++) jx_ms(&x, 0, 0x8B, regs[i], offs[i]);
+	jx_b(&x, 0xFF); jx_b(&x, 0xE6); /*jmp rsi*/
+	/*exit, with the effective address to go on at in eax*/
+	j->exit = x.p;
+	jx_ms(&x, 0, 0x89, JX_RAX, offsetof(sisa_jit_state, pc));
+	for(i = 0; i < 9; i++) jx_ms(&x, 0, 0x89, regs[i], offs[i]);
+	for(i = 6; i--;){jx_rex(&x, 0, 0, 0, saved[i], 0); jx_b(&x, 0x58 | (saved[i]&7));}
+	jx_b(&x, 0xC3);
+	memcpy(&j->enter, &j->arena, sizeof(j->enter));
+	j->base = j->used = ((x.p - j->arena) + 15) & ~(UU)15;
+	return 1;
+}
+static void sisa_jit_free(sisa_vm* vm){
+	UU t;
+	if(!vm->jit) return;
+	if(vm->jit->arena) munmap(vm->jit->arena, SISA_JIT_ARENA);
+	for(t = 0; t <= vm->ntasks; t++){
+		free(vm->JMAP[t]);
+		vm->JMAP[t] = NULL;
+		if(vm->jit->tbl) free(vm->jit->tbl[t]);
+	}
+	free(vm->jit->tbl);
+	free(vm->jit->has);
+	free(vm->jit);
+	vm->jit = NULL;
+}
@@ -0,0 +1,28 @@
+#!/usr/bin/sisa16_asm -run
+
+//Three tasks under krenel, each counting to 50 million and then printing its PID.
+//Built with -DUSE_THREADS, krenel runs them on separate host threads with task_par, so
+//this takes about as long as one of them would. They still print 123, in the same order as without.
+..include"libc_pre.hasm"
+..(2):
+..dinclude"libc_pre.bin"
+
+..main(3):
+	lrx0 %/parspin_boot%;
+	proc_krenel;
+	halt;
+..(55):
+	lrx0 %/0%; lrx1 %/50000000%;
+	parspin_looptop:
+		rxincr; rxcmp;
+		sc %parspin_looptop%; jmpifneq;
+	lla %0xDE07%; syscall; //getpid
+	lb '0'; add; putchar;
+	halt;
+..(8):
+	parspin_boot:
+		push %10%; //make some room for that bootloader!
+		lla %0xDE04%; lb 55; syscall;
+		lla %0xDE04%; lb 55; syscall;
+		lla %0xDE04%; lb 55; syscall;
+		halt;
@@ -0,0 +1,231 @@
+/*
+	Instruction profiler, for USE_PROFILE.
+
+	The dispatcher counts every instruction it is about to run, by opcode and by effective address,
+	separately for the kernel ([0]) and user tasks ([1]). Far calls and far returns are counted per
+	(from, to) edge, and the expensive instructions are counted once more as events.
+	None of it is compiled in without USE_PROFILE, and with it, nothing is counted unless the VM
+	was given a profile, which the drivers do for -profile.
+
+	The per address counts are kept by 64k region, allocated the first time the region is executed from.
+	If that allocation fails, the region just isn't counted.
+
+	The file written by sisa_prof_write is big endian, counters are 8 bytes, addresses 3:
+		"SISAPROF"
+		1 byte version (1)
+		1 byte number of events
+		256 kernel opcode counts, then 256 user opcode counts
+		the event counts, in the order of sisa_prof_event_names
+		4 byte number of edges which did not fit in the table
+		4 byte number of edges, then for each:
+			1 byte kind (0 farcall, 1 farret), 1 byte depth (0 kernel, 1 user), from, to, count
+		4 byte number of addresses, then for each:
+			1 byte depth, address, count
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define SISA_INSNS_NAMES_ONLY
+#include "instructions.h"
+#undef SISA_INSNS_NAMES_ONLY
+
+#define SISA_PROF_EDGES		0x2000	/*entries in the edge table, a power of two*/
+#define SISA_PROF_PROBES	16		/*slots tried before an edge is dropped*/
+#define SISA_PROF_TOP		16		/*lines per table in the summary*/
+
+enum{
+	SISA_PROF_FARPAGEL,
+	SISA_PROF_FARPAGEST,
+	SISA_PROF_USER_FARPAGEL,
+	SISA_PROF_USER_FARPAGEST,
+	SISA_PROF_SEG_LD,
+	SISA_PROF_SEG_ST,
+	SISA_PROF_CLOCK,
+	SISA_PROF_INTERRUPT,
+	SISA_PROF_EMULATE,
+	SISA_PROF_NEVENTS
+};
+static const char* const sisa_prof_event_names[SISA_PROF_NEVENTS] = {
+	"farpagel",
+	"farpagest",
+	"user_farpagel",
+	"user_farpagest",
+	"seg_ld",
+	"seg_st",
+	"clock",
+	"interrupt",
+	"emulate"
+};
+#define SISA_PROF_CALL 0
+#define SISA_PROF_RET 1
+
+typedef struct{
+	UU from, to; /*effective addresses*/
+	u kind;
+	u depth;
+	unsigned long hits; /*0 if the slot is free*/
+}sisa_prof_edge;
+
+typedef struct sisa_prof{
+	unsigned long ops[2][256];
+	unsigned long* pc[2][0x100]; /*hits per address, by region*/
+	u pc_failed[2][0x100]; /*the region could not be allocated, don't try again*/
+	unsigned long ev[SISA_PROF_NEVENTS];
+	unsigned long edges_dropped;
+	sisa_prof_edge edges[SISA_PROF_EDGES];
+}sisa_prof;
+
+static sisa_prof* sisa_prof_new(){
+	return calloc(1, sizeof(sisa_prof));
+}
+static void sisa_prof_free(sisa_prof* p){
+	UU d, i;
+	if(!p) return;
+	for(d = 0; d < 2; d++)
+		for(i = 0; i < 0x100; i++)
+			free(p->pc[d][i]);
+	free(p);
+}
+/*The first time a region is executed from.*/
+static unsigned long* sisa_prof_region(sisa_prof* p, UU d, UU r){
+	if(p->pc_failed[d][r]) return NULL;
+	p->pc[d][r] = calloc(0x10000, sizeof(unsigned long));
+	if(!p->pc[d][r]) p->pc_failed[d][r] = 1;
+	return p->pc[d][r];
+}
+/*Count the instruction op at effective address addr, at depth d.*/
+static void sisa_prof_insn(sisa_prof* p, UU d, u op, UU addr){
+	unsigned long* r = p->pc[d][(addr>>16) & 0xff];
+	p->ops[d][op]++;
+	if(!r && !(r = sisa_prof_region(p, d, (addr>>16) & 0xff))) return;
+	r[addr & 0xffFF]++;
+}
+static void sisa_prof_edge_hit(sisa_prof* p, u kind, UU d, UU from, UU to){
+	UU h = ((from * 0x9E3779B1) ^ (to * 0x85EBCA6B) ^ (kind + 2*d)) & 0xffffffff;
+	UU i;
+	h ^= h >> 15;
+	for(i = 0; i < SISA_PROF_PROBES; i++){
+		sisa_prof_edge* e = p->edges + ((h + i) & (SISA_PROF_EDGES-1));
+		if(!e->hits){
+			e->from = from; e->to = to; e->kind = kind; e->depth = d;
+			e->hits = 1;
+			return;
+		}
+		if(e->from == from && e->to == to && e->kind == kind && e->depth == d){
+			e->hits++;
+			return;
+		}
+	}
+	p->edges_dropped++;
+}
+
+static void sisa_prof_put(FILE* f, unsigned long v, UU n){
+	while(n--) fputc(n >= sizeof(unsigned long) ? 0 : (int)((v >> (8*n)) & 255), f);
+}
+/*Returns 0 if the file could not be written.*/
+static int sisa_prof_write(const sisa_prof* p, const char* fname){
+	FILE* f = fopen(fname, "wb");
+	unsigned long n = 0;
+	UU d, i, j;
+	if(!f) return 0;
+	fputs("SISAPROF", f);
+	sisa_prof_put(f, 1, 1);
+	sisa_prof_put(f, SISA_PROF_NEVENTS, 1);
+	for(d = 0; d < 2; d++)
+		for(i = 0; i < 256; i++) sisa_prof_put(f, p->ops[d][i], 8);
+	for(i = 0; i < SISA_PROF_NEVENTS; i++) sisa_prof_put(f, p->ev[i], 8);
+	sisa_prof_put(f, p->edges_dropped, 4);
+	for(i = 0; i < SISA_PROF_EDGES; i++) n += (p->edges[i].hits != 0);
+	sisa_prof_put(f, n, 4);
+	for(i = 0; i < SISA_PROF_EDGES; i++){
+		const sisa_prof_edge* e = p->edges + i;
+		if(!e->hits) continue;
+		sisa_prof_put(f, e->kind, 1);
+		sisa_prof_put(f, e->depth, 1);
+		sisa_prof_put(f, e->from, 3);
+		sisa_prof_put(f, e->to, 3);
+		sisa_prof_put(f, e->hits, 8);
+	}
+	n = 0;
+	for(d = 0; d < 2; d++)
+		for(i = 0; i < 0x100; i++)
+			if(p->pc[d][i])
+				for(j = 0; j < 0x10000; j++) n += (p->pc[d][i][j] != 0);
+	sisa_prof_put(f, n, 4);
+	for(d = 0; d < 2; d++)
+		for(i = 0; i < 0x100; i++)
+			if(p->pc[d][i])
+				for(j = 0; j < 0x10000; j++){
+					if(!p->pc[d][i][j]) continue;
+					sisa_prof_put(f, d, 1);
+					sisa_prof_put(f, (i<<16) | j, 3);
+					sisa_prof_put(f, p->pc[d][i][j], 8);
+				}
+	if(ferror(f)){fclose(f); return 0;}
+	return fclose(f) == 0;
+}
+
+/*Keep the biggest SISA_PROF_TOP of whatever is offered, biggest first.*/
+typedef struct{
+	unsigned long hits[SISA_PROF_TOP];
+	UU which[SISA_PROF_TOP];
+	UU n;
+}sisa_prof_top;
+static void sisa_prof_top_add(sisa_prof_top* t, unsigned long hits, UU which){
+	UU i;
+	if(!hits) return;
+	if(t->n == SISA_PROF_TOP && hits <= t->hits[SISA_PROF_TOP-1]) return;
+	if(t->n < SISA_PROF_TOP) t->n++;
+	for(i = t->n - 1; i > 0 && t->hits[i-1] < hits; i--){
+		t->hits[i] = t->hits[i-1];
+		t->which[i] = t->which[i-1];
+	}
+	t->hits[i] = hits;
+	t->which[i] = which;
+}
+static void sisa_prof_summary(const sisa_prof* p, FILE* f){
+	sisa_prof_top t;
+	unsigned long total[2] = {0,0};
+	UU d, i, j;
+	for(d = 0; d < 2; d++)
+		for(i = 0; i < 256; i++) total[d] += p->ops[d][i];
+	fprintf(f, "\n~~SISA16 profile~~\n%lu instructions in the kernel, %lu in user tasks\n", total[0], total[1]);
+	for(d = 0; d < 2; d++){
+		if(!total[d]) continue;
+		memset(&t, 0, sizeof(t));
+		for(i = 0; i < 256; i++) sisa_prof_top_add(&t, p->ops[d][i], i);
+		fprintf(f, "Top opcodes, %s:\n", d ? "user" : "kernel");
+		for(i = 0; i < t.n; i++)
+			fprintf(f, "\t%-16s %12lu %6.2f%%\n",
+				t.which[i] < n_insns ? insns[t.which[i]] : "illegal",
+				t.hits[i], 100.0 * t.hits[i] / total[d]
+			);
+		memset(&t, 0, sizeof(t));
+		for(i = 0; i < 0x100; i++)
+			if(p->pc[d][i])
+				for(j = 0; j < 0x10000; j++) sisa_prof_top_add(&t, p->pc[d][i][j], (i<<16) | j);
+		fprintf(f, "Top addresses, %s:\n", d ? "user" : "kernel");
+		for(i = 0; i < t.n; i++)
+			fprintf(f, "\t%06lx %12lu %6.2f%%\n", (unsigned long)t.which[i], t.hits[i], 100.0 * t.hits[i] / total[d]);
+	}
+	memset(&t, 0, sizeof(t));
+	for(i = 0; i < SISA_PROF_EDGES; i++) sisa_prof_top_add(&t, p->edges[i].hits, i);
+	if(t.n) fputs("Top far calls and returns:\n", f);
+	for(i = 0; i < t.n; i++){
+		const sisa_prof_edge* e = p->edges + t.which[i];
+		fprintf(f, "\t%s %-7s %06lx -> %06lx %12lu\n",
+			e->depth ? "user  " : "kernel", e->kind == SISA_PROF_CALL ? "farcall" : "farret",
+			(unsigned long)e->from, (unsigned long)e->to, e->hits
+		);
+	}
+	if(p->edges_dropped) fprintf(f, "\t(%lu far calls and returns did not fit in the table)\n", p->edges_dropped);
+	fputs("Expensive instructions:\n", f);
+	for(i = 0; i < SISA_PROF_NEVENTS; i++)
+		fprintf(f, "\t%-16s %12lu\n", sisa_prof_event_names[i], p->ev[i]);
+}
+/*Write the profile to fname and the summary to stderr.*/
+static void sisa_prof_report(const sisa_prof* p, const char* fname){
+	if(!sisa_prof_write(p, fname))
+		fprintf(stderr, "\n<SISA16 cannot write the profile to %s>\n", fname);
+	sisa_prof_summary(p, stderr);
+}
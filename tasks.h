@@ -0,0 +1,110 @@
+/*
+	task_par: run several user tasks at once.
+
+	Bit i of a asks for task 16*b + i + 1, so b picks a group of sixteen. Tasks which task_set never picked
+	are left alone. Each one runs from where it left off until it halts or uses up its
+	PREEMPT_TIMER slice, exactly as if the kernel had switched to it with TB, and the kernel waits for all of them.
+	The next TB of each of those tasks then doesn't run it again, it only hands over the code it halted with in a.
+	So a kernel which does task_par and then goes round its tasks with TB as usual sees the same codes,
+	in the same order, as it would have without task_par. A task which is still holding a code isn't run again,
+	and emulate or task_kill on a task throws its code away. Krenel does this whenever task_max says more than
+	one task can run at once, see libc_krenel_try_select_task and parspin.asm.
+
+	Tasks don't share anything but regions of sparse memory, which are copy-on-write and faulted under a lock.
+	With USE_THREADS they run on a pool of threads, one for each task of a group, started the first time task_par is used.
+	Otherwise they run one after the other.
+*/
+
+#ifdef USE_THREADS
+typedef struct sisa_pool{
+	sisa_vm* vm;
+	pthread_t th[SISA_PAR_GROUP];
+	UU nth;
+	pthread_mutex_t lock;
+	pthread_cond_t go; /*there is work, or it is time to quit*/
+	pthread_cond_t done; /*the last task of a batch finished*/
+	UU first; /*the task bit 0 of todo stands for*/
+	UU todo; /*tasks nobody has picked up yet*/
+	UU left; /*tasks which haven't finished yet*/
+	int quit;
+}sisa_pool;
+
+static void* sisa_pool_worker(void* arg){
+	sisa_pool* p = arg;
+	pthread_mutex_lock(&p->lock);
+	for(;;){
+		UU t;
+		u code;
+		while(!p->todo && !p->quit) pthread_cond_wait(&p->go, &p->lock);
+		if(p->quit) break;
+		for(t = 0; !(p->todo & (1<<t)); t++);
+		p->todo &= ~(1<<t);
+		t += p->first;
+		pthread_mutex_unlock(&p->lock);
+		code = sisa_exec(p->vm, 0, t);
+		pthread_mutex_lock(&p->lock);
+		p->vm->task_code[t] = code;
+		p->vm->task_done[t] = 1;
+		if(!--p->left) pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return NULL;
+}
+static void sisa_pool_free(sisa_vm* vm){
+	sisa_pool* p = vm->pool;
+	UU i;
+	if(!p) return;
+	pthread_mutex_lock(&p->lock);
+	p->quit = 1;
+	pthread_cond_broadcast(&p->go);
+	pthread_mutex_unlock(&p->lock);
+	for(i = 0; i < p->nth; i++) pthread_join(p->th[i], NULL);
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->go);
+	pthread_mutex_destroy(&p->lock);
+	free(p);
+	vm->pool = NULL;
+}
+/*Returns NULL if not a single thread could be started.*/
+static sisa_pool* sisa_pool_new(sisa_vm* vm){
+	sisa_pool* p = calloc(1, sizeof(sisa_pool));
+	if(!p) return NULL;
+	p->vm = vm;
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->go, NULL);
+	pthread_cond_init(&p->done, NULL);
+	vm->pool = p;
+	while(p->nth < SISA_PAR_GROUP && p->nth < vm->ntasks && !pthread_create(p->th + p->nth, NULL, sisa_pool_worker, p))
+		p->nth++;
+	if(!p->nth) sisa_pool_free(vm);
+	return vm->pool;
+}
+#endif
+
+static void sisa_task_par(sisa_vm* vm, UU group, UU mask){
+	UU first = SISA_PAR_GROUP * group + 1;
+	UU t;
+	mask &= (1<<SISA_PAR_GROUP) - 1;
+	for(t = 0; t < SISA_PAR_GROUP; t++)
+		if(first + t > vm->ntasks || !vm->M_SAVER[first + t] || vm->task_done[first + t])
+			mask &= ~(1<<t);
+	if(!mask) return;
+#ifdef USE_THREADS
+	if(vm->pool || sisa_pool_new(vm)){
+		sisa_pool* p = vm->pool;
+		pthread_mutex_lock(&p->lock);
+		p->first = first;
+		p->todo = mask;
+		for(p->left = 0; mask; mask &= mask - 1) p->left++;
+		pthread_cond_broadcast(&p->go);
+		while(p->left) pthread_cond_wait(&p->done, &p->lock);
+		pthread_mutex_unlock(&p->lock);
+		return;
+	}
+#endif
+	for(t = 0; t < SISA_PAR_GROUP; t++)
+		if(mask & (1<<t)){
+			vm->task_code[first + t] = sisa_exec(vm, 0, first + t);
+			vm->task_done[first + t] = 1;
+		}
+}